@@ -1,5 +1,7 @@
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <fstream>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -7,855 +9,1821 @@
 #include <set>
 #include <iomanip>
 #include <limits>
+#include <cstdint>
+#include <cstdlib>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <filesystem>
+#include <cstddef>
+#include <cassert>
+#include <new>
+#include <memory>
+#include <type_traits>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
-enum Color { WHITE, BLACK };
+enum Color : uint8_t { WHITE, BLACK };
 
-// Base Piece class
-class Piece {
-public:
-    Color color;
-    string name;
-    string symbol;
-    bool hasMoved;
-    int value;
-
-    Piece(Color c, string n, string s, int v) : color(c), name(n), symbol(s), hasMoved(false), value(v) {}
-    virtual ~Piece() {}
-    virtual bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) = 0;
-    virtual vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) = 0;
-    virtual string getType() = 0;
+// Pieces are packed into 4 bits: the low three bits hold the type, bit 3 the color.
+// An empty square is 0, so a whole board is a plain 64-byte array.
+enum PieceType : uint8_t { NO_TYPE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+typedef uint8_t Piece;
+const Piece EMPTY = 0;
+
+inline Piece makePiece(Color c, PieceType t) { return (Piece)((c << 3) | t); }
+inline PieceType typeOf(Piece p) { return (PieceType)(p & 7); }
+inline Color colorOf(Piece p) { return (Color)(p >> 3); }
+inline Color opposite(Color c) { return c == WHITE ? BLACK : WHITE; }
+
+// Squares are numbered row * 8 + col, row 0 being Black's back rank
+inline int toSquare(int row, int col) { return row * 8 + col; }
+inline int rowOf(int sq) { return sq >> 3; }
+inline int colOf(int sq) { return sq & 7; }
+inline bool onBoard(int row, int col) { return row >= 0 && row < 8 && col >= 0 && col < 8; }
+
+const char* const TYPE_NAMES[7] = {"", "Pawn", "Knight", "Bishop", "Rook", "Queen", "King"};
+
+// Movement tables as (row, col) deltas
+const int KNIGHT_STEPS[8][2] = {{-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1}};
+// Rook directions first, then bishop directions; the king uses all eight for single steps
+const int SLIDE_DIRS[8][2] = {{-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
+// Range of SLIDE_DIRS used by each piece type
+const int SLIDE_FIRST[7] = {0, 0, 0, 4, 0, 0, 0};
+const int SLIDE_LAST[7]  = {0, 0, 0, 8, 4, 8, 8};
+
+enum CastlingRight : uint8_t {
+    WHITE_KINGSIDE = 1, WHITE_QUEENSIDE = 2,
+    BLACK_KINGSIDE = 4, BLACK_QUEENSIDE = 8
 };
 
-// Pawn class
-class Pawn : public Piece {
-public:
-    Pawn(Color c) : Piece(c, c == WHITE ? "WP" : "BP", c == WHITE ? "P" : "p", 1) {}
-    
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        int fromRow = from.first, fromCol = from.second;
-        int toRow = to.first, toCol = to.second;
-        int direction = (color == WHITE) ? -1 : 1;
-        
-        // Forward move
-        if (fromCol == toCol) {
-            if (toRow == fromRow + direction && board[toRow][toCol] == nullptr) {
-                return true;
-            }
-            // Double move on first move
-            if (!hasMoved && toRow == fromRow + 2 * direction && 
-                board[toRow][toCol] == nullptr && 
-                board[fromRow + direction][fromCol] == nullptr) {
-                return true;
-            }
-        }
-        // Diagonal capture
-        else if (abs(fromCol - toCol) == 1 && toRow == fromRow + direction) {
-            if (board[toRow][toCol] != nullptr && board[toRow][toCol]->color != color) {
-                return true;
-            }
+// Castling rights that survive a move touching the given square
+inline uint8_t castlingMask(int sq) {
+    switch (sq) {
+        case 0:  return (uint8_t)~BLACK_QUEENSIDE;
+        case 4:  return (uint8_t)~(BLACK_KINGSIDE | BLACK_QUEENSIDE);
+        case 7:  return (uint8_t)~BLACK_KINGSIDE;
+        case 56: return (uint8_t)~WHITE_QUEENSIDE;
+        case 60: return (uint8_t)~(WHITE_KINGSIDE | WHITE_QUEENSIDE);
+        case 63: return (uint8_t)~WHITE_KINGSIDE;
+        default: return 0xF;
+    }
+}
+
+const uint8_t NO_SQUARE = 64;
+
+// Zobrist keys, generated at compile time with splitmix64 so hashes are stable across runs
+struct ZobristKeys {
+    uint64_t pieces[16][64];
+    uint64_t castling[16];
+    uint64_t enPassant[8];
+    uint64_t side;
+};
+
+constexpr uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+constexpr ZobristKeys makeZobristKeys() {
+    ZobristKeys keys = {};
+    uint64_t state = 0x5EED5EED5EED5EEDULL;
+    for (int p = 0; p < 16; p++) {
+        for (int sq = 0; sq < 64; sq++) {
+            // The empty square hashes to nothing so it can be XORed blindly
+            keys.pieces[p][sq] = (p == EMPTY) ? 0 : splitMix64(state);
         }
-        return false;
     }
+    for (int i = 0; i < 16; i++) keys.castling[i] = splitMix64(state);
+    for (int i = 0; i < 8; i++) keys.enPassant[i] = splitMix64(state);
+    keys.side = splitMix64(state);
+    return keys;
+}
+
+constexpr ZobristKeys ZOBRIST = makeZobristKeys();
+
+// Everything needed to play on from a position. Plain bytes, so copying it is cheap.
+struct Position {
+    Piece squares[64];
+    Color sideToMove;
+    uint8_t castlingRights;
+    uint8_t epSquare;          // square a pawn can capture en passant onto, or NO_SQUARE
+    uint16_t halfmoveClock;    // plies since the last capture or pawn move (50-move rule)
+    uint16_t fullmoveNumber;   // starts at 1 and goes up after each Black move
+    uint64_t hash;
+};
+
+static_assert(sizeof(Position) < 100, "Position must stay cheap to copy");
+
+// A move packed into 16 bits: from (6), to (6) and the promotion piece type (3).
+// Castling is a two-square king move; en passant is a pawn move onto epSquare.
+typedef uint16_t Move;
+
+inline Move encodeMove(int from, int to, PieceType promotion = NO_TYPE) {
+    return (Move)(from | (to << 6) | (promotion << 12));
+}
+inline int moveFrom(Move m) { return m & 63; }
+inline int moveTo(Move m) { return (m >> 6) & 63; }
+inline PieceType movePromotion(Move m) { return (PieceType)((m >> 12) & 7); }
+
+// Fixed-capacity move buffer so generating moves never touches the heap
+struct MoveList {
+    Move moves[256];
+    int count = 0;
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int direction = (color == WHITE) ? -1 : 1;
-        
-        // Forward moves
-        if (row + direction >= 0 && row + direction < 8 && board[row + direction][col] == nullptr) {
-            moves.push_back({row + direction, col});
-            if (!hasMoved && row + 2 * direction >= 0 && row + 2 * direction < 8 && 
-                board[row + 2 * direction][col] == nullptr) {
-                moves.push_back({row + 2 * direction, col});
-            }
-        }
-        
-        // Diagonal captures
-        for (int c : {col - 1, col + 1}) {
-            if (c >= 0 && c < 8 && row + direction >= 0 && row + direction < 8) {
-                if (board[row + direction][c] != nullptr && board[row + direction][c]->color != color) {
-                    moves.push_back({row + direction, c});
-                }
-            }
-        }
-        
-        return moves;
+    void add(Move m) {
+        assert(count < 256);
+        moves[count++] = m;
     }
+};
+
+// The 50-move rule ends any game within 5949 moves, so a game's positions always fit here
+const int MAX_GAME_PLIES = 12000;
+
+// Hashes of the positions along a game (and, inside the search, down to the current node).
+// Fixed capacity, so recording a position never allocates.
+struct KeyHistory {
+    uint64_t keys[MAX_GAME_PLIES + 64];
+    int count = 0;
     
-    string getType() override { return "Pawn"; }
+    void clear() { count = 0; }
+    void push_back(uint64_t key) { if (count < MAX_GAME_PLIES + 64) keys[count++] = key; }
+    void pop_back() { count--; }
+    uint64_t back() const { return keys[count - 1]; }
+    bool empty() const { return count == 0; }
+    int size() const { return count; }
+    uint64_t operator[](int i) const { return keys[i]; }
+    
+    void assign(const KeyHistory& other) {
+        copy(other.keys, other.keys + other.count, keys);
+        count = other.count;
+    }
 };
 
-// Knight class - Fixed naming to avoid confusion with King
-class Knight : public Piece {
+// For searches from a position with no game behind it
+const KeyHistory NO_HISTORY = {};
+
+// Bump allocator over one block taken up front. Objects are carved out back to back and
+// released all at once by reset(), so only trivially destructible types may live in it.
+class Arena {
+private:
+    char* block;
+    size_t capacity;
+    size_t used = 0;
+    
 public:
-    Knight(Color c) : Piece(c, c == WHITE ? "WN" : "BN", c == WHITE ? "N" : "n", 3) {}
+    explicit Arena(size_t bytes) : block(static_cast<char*>(::operator new(bytes))), capacity(bytes) {}
+    ~Arena() { ::operator delete(block); }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        int rowDiff = abs(from.first - to.first);
-        int colDiff = abs(from.second - to.second);
-        return (rowDiff == 2 && colDiff == 1) || (rowDiff == 1 && colDiff == 2);
+    void* allocate(size_t bytes, size_t alignment) {
+        size_t start = (used + alignment - 1) & ~(alignment - 1);
+        if (start + bytes > capacity) throw bad_alloc();
+        used = start + bytes;
+        return block + start;
     }
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int knightMoves[8][2] = {{-2,-1}, {-2,1}, {-1,-2}, {-1,2}, {1,-2}, {1,2}, {2,-1}, {2,1}};
-        
-        for (int i = 0; i < 8; i++) {
-            int newRow = row + knightMoves[i][0];
-            int newCol = col + knightMoves[i][1];
-            if (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == nullptr || board[newRow][newCol]->color != color) {
-                    moves.push_back({newRow, newCol});
-                }
-            }
-        }
-        return moves;
+    // Uninitialized storage for 'count' objects of type T
+    template <typename T>
+    T* allocateArray(size_t count) {
+        static_assert(is_trivially_destructible<T>::value, "arena memory is released without destructors");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
     }
     
-    string getType() override { return "Knight"; }
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        static_assert(is_trivially_destructible<T>::value, "arena memory is released without destructors");
+        return new (allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+    
+    void reset() { used = 0; }
+    size_t bytesUsed() const { return used; }
 };
 
-// Bishop class
-class Bishop : public Piece {
-public:
-    Bishop(Color c) : Piece(c, c == WHITE ? "WB" : "BB", c == WHITE ? "B" : "b", 3) {}
+uint64_t computeHash(const Position& pos) {
+    uint64_t hash = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        hash ^= ZOBRIST.pieces[pos.squares[sq]][sq];
+    }
+    hash ^= ZOBRIST.castling[pos.castlingRights];
+    if (pos.epSquare != NO_SQUARE) hash ^= ZOBRIST.enPassant[colOf(pos.epSquare)];
+    if (pos.sideToMove == BLACK) hash ^= ZOBRIST.side;
+    return hash;
+}
+
+// The en passant square is only recorded when an enemy pawn stands ready to use it,
+// so positions that differ in name only hash the same for repetition detection
+bool canCaptureEnPassant(const Position& pos, int pawnSq, Color capturer) {
+    Piece enemyPawn = makePiece(capturer, PAWN);
+    return (colOf(pawnSq) > 0 && pos.squares[pawnSq - 1] == enemyPawn) ||
+           (colOf(pawnSq) < 7 && pos.squares[pawnSq + 1] == enemyPawn);
+}
+
+bool isPathClear(const Position& pos, int from, int to) {
+    int rowDiff = rowOf(to) - rowOf(from);
+    int colDiff = colOf(to) - colOf(from);
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        int rowDiff = abs(from.first - to.first);
-        int colDiff = abs(from.second - to.second);
-        return rowDiff == colDiff && rowDiff > 0;
+    int rowDir = (rowDiff == 0) ? 0 : (rowDiff > 0) ? 1 : -1;
+    int colDir = (colDiff == 0) ? 0 : (colDiff > 0) ? 1 : -1;
+    int step = rowDir * 8 + colDir;
+    
+    for (int sq = from + step; sq != to; sq += step) {
+        if (pos.squares[sq] != EMPTY) {
+            return false;
+        }
     }
+    return true;
+}
+
+// Checks the movement pattern of the piece on 'from', including blocked paths,
+// without regard to whether the move leaves its own king in check
+bool canReach(const Position& pos, int from, int to) {
+    Piece piece = pos.squares[from];
+    if (piece == EMPTY || from == to) return false;
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int directions[4][2] = {{-1,-1}, {-1,1}, {1,-1}, {1,1}};
-        
-        for (int i = 0; i < 4; i++) {
-            int newRow = row + directions[i][0];
-            int newCol = col + directions[i][1];
-            while (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == nullptr) {
-                    moves.push_back({newRow, newCol});
-                } else {
-                    if (board[newRow][newCol]->color != color) {
-                        moves.push_back({newRow, newCol});
-                    }
-                    break;
-                }
-                newRow += directions[i][0];
-                newCol += directions[i][1];
+    Piece target = pos.squares[to];
+    if (target != EMPTY && colorOf(target) == colorOf(piece)) return false;
+    
+    int rowDiff = rowOf(to) - rowOf(from);
+    int colDiff = colOf(to) - colOf(from);
+    
+    switch (typeOf(piece)) {
+        case PAWN: {
+            int direction = (colorOf(piece) == WHITE) ? -1 : 1;
+            int startRow = (colorOf(piece) == WHITE) ? 6 : 1;
+            // Forward move, or double move from the starting row
+            if (colDiff == 0) {
+                if (target != EMPTY) return false;
+                if (rowDiff == direction) return true;
+                return rowDiff == 2 * direction && rowOf(from) == startRow &&
+                       pos.squares[from + 8 * direction] == EMPTY;
             }
+            // Diagonal capture, including en passant
+            return abs(colDiff) == 1 && rowDiff == direction && (target != EMPTY || to == pos.epSquare);
         }
-        return moves;
+        case KNIGHT:
+            return (abs(rowDiff) == 2 && abs(colDiff) == 1) || (abs(rowDiff) == 1 && abs(colDiff) == 2);
+        case KING:
+            return abs(rowDiff) <= 1 && abs(colDiff) <= 1;
+        case BISHOP:
+            if (abs(rowDiff) != abs(colDiff)) return false;
+            break;
+        case ROOK:
+            if (rowDiff != 0 && colDiff != 0) return false;
+            break;
+        case QUEEN:
+            if (rowDiff != 0 && colDiff != 0 && abs(rowDiff) != abs(colDiff)) return false;
+            break;
+        default:
+            return false;
     }
-    
-    string getType() override { return "Bishop"; }
-};
+    return isPathClear(pos, from, to);
+}
 
-// Rook class
-class Rook : public Piece {
-public:
-    Rook(Color c) : Piece(c, c == WHITE ? "WR" : "BR", c == WHITE ? "R" : "r", 5) {}
+bool isSquareAttacked(const Position& pos, int sq, Color by) {
+    int row = rowOf(sq), col = colOf(sq);
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        return (from.first == to.first && from.second != to.second) || 
-               (from.second == to.second && from.first != to.first);
+    // Pawns attack diagonally towards the opponent, so look one row back from their side
+    int pawnRow = row + (by == WHITE ? 1 : -1);
+    for (int c : {col - 1, col + 1}) {
+        if (onBoard(pawnRow, c) && pos.squares[toSquare(pawnRow, c)] == makePiece(by, PAWN)) {
+            return true;
+        }
     }
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int directions[4][2] = {{-1,0}, {1,0}, {0,-1}, {0,1}};
-        
-        for (int i = 0; i < 4; i++) {
-            int newRow = row + directions[i][0];
-            int newCol = col + directions[i][1];
-            while (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == nullptr) {
-                    moves.push_back({newRow, newCol});
-                } else {
-                    if (board[newRow][newCol]->color != color) {
-                        moves.push_back({newRow, newCol});
-                    }
-                    break;
+    for (int i = 0; i < 8; i++) {
+        int r = row + KNIGHT_STEPS[i][0], c = col + KNIGHT_STEPS[i][1];
+        if (onBoard(r, c) && pos.squares[toSquare(r, c)] == makePiece(by, KNIGHT)) {
+            return true;
+        }
+        r = row + SLIDE_DIRS[i][0];
+        c = col + SLIDE_DIRS[i][1];
+        if (onBoard(r, c) && pos.squares[toSquare(r, c)] == makePiece(by, KING)) {
+            return true;
+        }
+    }
+    
+    // Walk each line outwards until the first piece; rook lines first, then bishop lines
+    for (int d = 0; d < 8; d++) {
+        PieceType slider = (d < 4) ? ROOK : BISHOP;
+        int r = row + SLIDE_DIRS[d][0], c = col + SLIDE_DIRS[d][1];
+        while (onBoard(r, c)) {
+            Piece p = pos.squares[toSquare(r, c)];
+            if (p != EMPTY) {
+                if (colorOf(p) == by && (typeOf(p) == slider || typeOf(p) == QUEEN)) {
+                    return true;
                 }
-                newRow += directions[i][0];
-                newCol += directions[i][1];
+                break;
             }
+            r += SLIDE_DIRS[d][0];
+            c += SLIDE_DIRS[d][1];
         }
-        return moves;
     }
-    
-    string getType() override { return "Rook"; }
-};
+    return false;
+}
 
-// Queen class
-class Queen : public Piece {
-public:
-    Queen(Color c) : Piece(c, c == WHITE ? "WQ" : "BQ", c == WHITE ? "Q" : "q", 9) {}
+int findKing(const Position& pos, Color color) {
+    Piece king = makePiece(color, KING);
+    for (int sq = 0; sq < 64; sq++) {
+        if (pos.squares[sq] == king) return sq;
+    }
+    return -1;
+}
+
+bool isInCheck(const Position& pos, Color color) {
+    int kingSq = findKing(pos, color);
+    if (kingSq == -1) return false;
+    return isSquareAttacked(pos, kingSq, opposite(color));
+}
+
+bool canCastle(const Position& pos, Color color, bool kingside) {
+    uint8_t right = (color == WHITE) ? (kingside ? WHITE_KINGSIDE : WHITE_QUEENSIDE)
+                                     : (kingside ? BLACK_KINGSIDE : BLACK_QUEENSIDE);
+    if (!(pos.castlingRights & right)) return false;
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        int rowDiff = abs(from.first - to.first);
-        int colDiff = abs(from.second - to.second);
-        return (from.first == to.first && from.second != to.second) || 
-               (from.second == to.second && from.first != to.first) ||
-               (rowDiff == colDiff && rowDiff > 0);
+    int row = (color == WHITE) ? 7 : 0;
+    if (pos.squares[toSquare(row, 4)] != makePiece(color, KING)) return false;
+    if (pos.squares[toSquare(row, kingside ? 7 : 0)] != makePiece(color, ROOK)) return false;
+    
+    // Check if path is clear
+    int start = kingside ? 5 : 1;
+    int end = kingside ? 6 : 3;
+    for (int i = start; i <= end; i++) {
+        if (pos.squares[toSquare(row, i)] != EMPTY) return false;
     }
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int directions[8][2] = {{-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
-        
-        for (int i = 0; i < 8; i++) {
-            int newRow = row + directions[i][0];
-            int newCol = col + directions[i][1];
-            while (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == nullptr) {
-                    moves.push_back({newRow, newCol});
+    // King may not castle out of, through or into check
+    for (int i = 0; i <= 2; i++) {
+        if (isSquareAttacked(pos, toSquare(row, kingside ? 4 + i : 4 - i), opposite(color))) return false;
+    }
+    return true;
+}
+
+// Appends the pseudo-legal moves of the piece on 'from'; legality against checks is left to the caller
+void getPossibleMoves(const Position& pos, int from, MoveList& moves) {
+    Piece piece = pos.squares[from];
+    Color color = colorOf(piece);
+    int row = rowOf(from), col = colOf(from);
+    
+    switch (typeOf(piece)) {
+        case PAWN: {
+            int direction = (color == WHITE) ? -1 : 1;
+            int startRow = (color == WHITE) ? 6 : 1;
+            int newRow = row + direction;
+            if (newRow < 0 || newRow >= 8) break;
+            bool promotes = (newRow == 0 || newRow == 7);
+            
+            auto addPawnMove = [&](int to) {
+                if (promotes) {
+                    for (PieceType promotion : {QUEEN, ROOK, BISHOP, KNIGHT}) {
+                        moves.add(encodeMove(from, to, promotion));
+                    }
                 } else {
-                    if (board[newRow][newCol]->color != color) {
-                        moves.push_back({newRow, newCol});
+                    moves.add(encodeMove(from, to));
+                }
+            };
+            
+            // Forward moves
+            if (pos.squares[toSquare(newRow, col)] == EMPTY) {
+                addPawnMove(toSquare(newRow, col));
+                if (row == startRow && pos.squares[toSquare(newRow + direction, col)] == EMPTY) {
+                    moves.add(encodeMove(from, toSquare(newRow + direction, col)));
+                }
+            }
+            // Diagonal captures, including en passant
+            for (int c : {col - 1, col + 1}) {
+                if (c >= 0 && c < 8) {
+                    int to = toSquare(newRow, c);
+                    Piece target = pos.squares[to];
+                    if ((target != EMPTY && colorOf(target) != color) || to == pos.epSquare) {
+                        addPawnMove(to);
                     }
-                    break;
                 }
-                newRow += directions[i][0];
-                newCol += directions[i][1];
             }
+            break;
+        }
+        case KNIGHT:
+        case KING: {
+            const int (*steps)[2] = (typeOf(piece) == KNIGHT) ? KNIGHT_STEPS : SLIDE_DIRS;
+            for (int i = 0; i < 8; i++) {
+                int newRow = row + steps[i][0];
+                int newCol = col + steps[i][1];
+                if (onBoard(newRow, newCol)) {
+                    Piece target = pos.squares[toSquare(newRow, newCol)];
+                    if (target == EMPTY || colorOf(target) != color) {
+                        moves.add(encodeMove(from, toSquare(newRow, newCol)));
+                    }
+                }
+            }
+            if (typeOf(piece) == KING) {
+                if (canCastle(pos, color, true)) moves.add(encodeMove(from, from + 2));
+                if (canCastle(pos, color, false)) moves.add(encodeMove(from, from - 2));
+            }
+            break;
+        }
+        default: {
+            for (int d = SLIDE_FIRST[typeOf(piece)]; d < SLIDE_LAST[typeOf(piece)]; d++) {
+                int newRow = row + SLIDE_DIRS[d][0];
+                int newCol = col + SLIDE_DIRS[d][1];
+                while (onBoard(newRow, newCol)) {
+                    Piece target = pos.squares[toSquare(newRow, newCol)];
+                    if (target == EMPTY) {
+                        moves.add(encodeMove(from, toSquare(newRow, newCol)));
+                    } else {
+                        if (colorOf(target) != color) {
+                            moves.add(encodeMove(from, toSquare(newRow, newCol)));
+                        }
+                        break;
+                    }
+                    newRow += SLIDE_DIRS[d][0];
+                    newCol += SLIDE_DIRS[d][1];
+                }
+            }
+            break;
         }
-        return moves;
     }
-    
-    string getType() override { return "Queen"; }
-};
+}
 
-// King class
-class King : public Piece {
-public:
-    King(Color c) : Piece(c, c == WHITE ? "WKG" : "BKG", c == WHITE ? "K" : "k", 0) {}
+// Plays a move already known to be pseudo-legal, keeping the hash up to date incrementally
+void applyMove(Position& pos, Move move) {
+    int from = moveFrom(move), to = moveTo(move);
+    Piece piece = pos.squares[from];
+    uint64_t hash = pos.hash;
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to, Piece* board[8][8]) override {
-        int rowDiff = abs(from.first - to.first);
-        int colDiff = abs(from.second - to.second);
-        return rowDiff <= 1 && colDiff <= 1 && (rowDiff != 0 || colDiff != 0);
+    pos.halfmoveClock++;
+    if (typeOf(piece) == PAWN) {
+        pos.halfmoveClock = 0;
+        // En passant removes the pawn that passed, which sits beside 'from'
+        if (to == pos.epSquare) {
+            int capturedSq = toSquare(rowOf(from), colOf(to));
+            hash ^= ZOBRIST.pieces[pos.squares[capturedSq]][capturedSq];
+            pos.squares[capturedSq] = EMPTY;
+        }
     }
     
-    vector<pair<int,int>> getPossibleMoves(pair<int,int> pos, Piece* board[8][8]) override {
-        vector<pair<int,int>> moves;
-        int row = pos.first, col = pos.second;
-        int directions[8][2] = {{-1,0}, {1,0}, {0,-1}, {0,1}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
-        
-        for (int i = 0; i < 8; i++) {
-            int newRow = row + directions[i][0];
-            int newCol = col + directions[i][1];
-            if (newRow >= 0 && newRow < 8 && newCol >= 0 && newCol < 8) {
-                if (board[newRow][newCol] == nullptr || board[newRow][newCol]->color != color) {
-                    moves.push_back({newRow, newCol});
-                }
-            }
-        }
-        return moves;
+    if (pos.squares[to] != EMPTY) {
+        pos.halfmoveClock = 0;
+        hash ^= ZOBRIST.pieces[pos.squares[to]][to];
     }
     
-    string getType() override { return "King"; }
-};
-
-// Game class
-class Game {
-private:
-    Piece* board[8][8];
-    Color currentTurn;
-    map<string, pair<int,int>> piecePositions;
-    vector<string> moveHistory;
-    int movesSinceCapture;
-    bool whiteKingMoved, blackKingMoved;
-    bool whiteRookLeftMoved, whiteRookRightMoved;
-    bool blackRookLeftMoved, blackRookRightMoved;
+    if (typeOf(piece) == KING && abs(colOf(to) - colOf(from)) == 2) {
+        bool kingside = colOf(to) > colOf(from);
+        int rookFrom = kingside ? from + 3 : from - 4;
+        int rookTo = kingside ? from + 1 : from - 1;
+        hash ^= ZOBRIST.pieces[pos.squares[rookFrom]][rookFrom] ^ ZOBRIST.pieces[pos.squares[rookFrom]][rookTo];
+        pos.squares[rookTo] = pos.squares[rookFrom];
+        pos.squares[rookFrom] = EMPTY;
+    }
     
-public:
-    Game() : currentTurn(WHITE), movesSinceCapture(0), 
-             whiteKingMoved(false), blackKingMoved(false),
-             whiteRookLeftMoved(false), whiteRookRightMoved(false),
-             blackRookLeftMoved(false), blackRookRightMoved(false) {
-        initializeBoard();
+    hash ^= ZOBRIST.pieces[piece][from];
+    if (movePromotion(move) != NO_TYPE) {
+        piece = makePiece(colorOf(piece), movePromotion(move));
     }
+    hash ^= ZOBRIST.pieces[piece][to];
+    pos.squares[to] = piece;
+    pos.squares[from] = EMPTY;
     
-    ~Game() {
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                delete board[i][j];
-            }
-        }
+    if (pos.epSquare != NO_SQUARE) hash ^= ZOBRIST.enPassant[colOf(pos.epSquare)];
+    pos.epSquare = NO_SQUARE;
+    if (typeOf(piece) == PAWN && abs(to - from) == 16 && canCaptureEnPassant(pos, to, opposite(colorOf(piece)))) {
+        pos.epSquare = (from + to) / 2;
+        hash ^= ZOBRIST.enPassant[colOf(pos.epSquare)];
     }
     
-    void initializeBoard() {
-        // Initialize empty board
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                board[i][j] = nullptr;
-            }
-        }
-        
-        // Place pieces (Black pieces at top, White pieces at bottom)
-        board[0][0] = new Rook(BLACK);
-        board[0][1] = new Knight(BLACK);
-        board[0][2] = new Bishop(BLACK);
-        board[0][3] = new Queen(BLACK);
-        board[0][4] = new King(BLACK);
-        board[0][5] = new Bishop(BLACK);
-        board[0][6] = new Knight(BLACK);
-        board[0][7] = new Rook(BLACK);
-        
-        for (int i = 0; i < 8; i++) {
-            board[1][i] = new Pawn(BLACK);
+    hash ^= ZOBRIST.castling[pos.castlingRights];
+    pos.castlingRights &= castlingMask(from) & castlingMask(to);
+    hash ^= ZOBRIST.castling[pos.castlingRights];
+    
+    if (pos.sideToMove == BLACK) pos.fullmoveNumber++;
+    pos.sideToMove = opposite(pos.sideToMove);
+    pos.hash = hash ^ ZOBRIST.side;
+}
+
+bool wouldBeInCheck(const Position& pos, Move move) {
+    Position next = pos;
+    applyMove(next, move);
+    return isInCheck(next, pos.sideToMove);
+}
+
+void generateMoves(const Position& pos, MoveList& moves) {
+    for (int sq = 0; sq < 64; sq++) {
+        Piece piece = pos.squares[sq];
+        if (piece != EMPTY && colorOf(piece) == pos.sideToMove) {
+            getPossibleMoves(pos, sq, moves);
         }
-        
-        for (int i = 0; i < 8; i++) {
-            board[6][i] = new Pawn(WHITE);
+    }
+}
+
+void generateLegalMoves(const Position& pos, MoveList& moves) {
+    generateMoves(pos, moves);
+    int legal = 0;
+    for (int i = 0; i < moves.count; i++) {
+        if (!wouldBeInCheck(pos, moves.moves[i])) {
+            moves.moves[legal++] = moves.moves[i];
         }
-        
-        board[7][0] = new Rook(WHITE);
-        board[7][1] = new Knight(WHITE);
-        board[7][2] = new Bishop(WHITE);
-        board[7][3] = new Queen(WHITE);
-        board[7][4] = new King(WHITE);
-        board[7][5] = new Bishop(WHITE);
-        board[7][6] = new Knight(WHITE);
-        board[7][7] = new Rook(WHITE);
-        
-        // Assign numbered names to pieces
-        assignPieceNumbers();
-        updatePiecePositions();
     }
-    
-    void assignPieceNumbers() {
-        // Assign numbers to pawns
-        int whitePawnCount = 1, blackPawnCount = 1;
-        int whiteRookCount = 1, blackRookCount = 1;
-        int whiteKnightCount = 1, blackKnightCount = 1;
-        int whiteBishopCount = 1, blackBishopCount = 1;
-        
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr) {
-                    string pieceType = board[i][j]->getType();
-                    if (pieceType == "Pawn") {
-                        if (board[i][j]->color == WHITE) {
-                            board[i][j]->name = "WP" + to_string(whitePawnCount++);
-                        } else {
-                            board[i][j]->name = "BP" + to_string(blackPawnCount++);
-                        }
-                    } else if (pieceType == "Rook") {
-                        if (board[i][j]->color == WHITE) {
-                            board[i][j]->name = "WR" + to_string(whiteRookCount++);
-                        } else {
-                            board[i][j]->name = "BR" + to_string(blackRookCount++);
-                        }
-                    } else if (pieceType == "Knight") {
-                        if (board[i][j]->color == WHITE) {
-                            board[i][j]->name = "WN" + to_string(whiteKnightCount++);
-                        } else {
-                            board[i][j]->name = "BN" + to_string(blackKnightCount++);
-                        }
-                    } else if (pieceType == "Bishop") {
-                        if (board[i][j]->color == WHITE) {
-                            board[i][j]->name = "WB" + to_string(whiteBishopCount++);
-                        } else {
-                            board[i][j]->name = "BB" + to_string(blackBishopCount++);
-                        }
-                    }
-                    // Queen and King keep their original names (WQ, BQ, WKG, BKG)
+    moves.count = legal;
+}
+
+bool hasLegalMove(const Position& pos) {
+    for (int sq = 0; sq < 64; sq++) {
+        Piece piece = pos.squares[sq];
+        if (piece != EMPTY && colorOf(piece) == pos.sideToMove) {
+            MoveList moves;
+            getPossibleMoves(pos, sq, moves);
+            for (int i = 0; i < moves.count; i++) {
+                if (!wouldBeInCheck(pos, moves.moves[i])) {
+                    return true;
                 }
             }
         }
     }
+    return false;
+}
+
+const char* const START_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+// Reads the first four FEN fields plus the optional halfmove clock. Returns false on malformed input.
+bool parseFen(const string& fen, Position& pos) {
+    istringstream in(fen);
+    string placement, side, castling, enPassant;
+    if (!(in >> placement >> side >> castling >> enPassant)) return false;
     
-    void updatePiecePositions() {
-        piecePositions.clear();
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr) {
-                    piecePositions[board[i][j]->name] = {i, j};
-                }
-            }
+    Position parsed = {};
+    int row = 0, col = 0;
+    for (char ch : placement) {
+        if (ch == '/') {
+            if (col != 8) return false;
+            row++;
+            col = 0;
+        } else if (ch >= '1' && ch <= '8') {
+            col += ch - '0';
+        } else {
+            static const string LETTERS = "pnbrqk";
+            size_t type = LETTERS.find((char)tolower(ch));
+            if (type == string::npos || !onBoard(row, col)) return false;
+            parsed.squares[toSquare(row, col++)] = makePiece(isupper(ch) ? WHITE : BLACK, (PieceType)(type + 1));
         }
+        if (col > 8) return false;
     }
+    if (row != 7 || col != 8) return false;
     
-    void printBoard() {
-        cout << "\n";
-        cout << "  +-----+-----+-----+-----+-----+-----+-----+-----+\n";
-        for (int i = 0; i < 8; i++) {
-            cout << (8 - i) << " |";
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr) {
-                    cout << setw(4) << board[i][j]->name << " |";
-                } else {
-                    cout << "     |";
-                }
-            }
-            cout << "\n";
-            cout << "  +-----+-----+-----+-----+-----+-----+-----+-----+\n";
+    // Only material a real game can reach: one king a side, at most 16 pieces and 8 pawns,
+    // each extra queen, rook, bishop or knight standing in for a promoted pawn, and no pawns
+    // on the first or last rank. This also keeps every move list within its 256 slots.
+    for (Color color : {WHITE, BLACK}) {
+        int counts[7] = {};
+        for (int sq = 0; sq < 64; sq++) {
+            Piece piece = parsed.squares[sq];
+            if (piece == EMPTY || colorOf(piece) != color) continue;
+            counts[typeOf(piece)]++;
+            if (typeOf(piece) == PAWN && (rowOf(sq) == 0 || rowOf(sq) == 7)) return false;
         }
-        cout << "     a     b     c     d     e     f     g     h\n\n";
+        int promoted = max(0, counts[QUEEN] - 1) + max(0, counts[ROOK] - 2) +
+                       max(0, counts[BISHOP] - 2) + max(0, counts[KNIGHT] - 2);
+        if (counts[KING] != 1 || counts[PAWN] + promoted > 8) return false;
     }
     
-    void showAlivePieces(Color color) {
-        cout << "\n*** " << (color == WHITE ? "White's" : "Black's") << " alive pieces: ***\n";
-        bool first = true;
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr && board[i][j]->color == color) {
-                    if (!first) cout << ", ";
-                    cout << board[i][j]->name;
-                    first = false;
-                }
-            }
+    if (side != "w" && side != "b") return false;
+    parsed.sideToMove = (side == "w") ? WHITE : BLACK;
+    
+    for (char ch : castling) {
+        switch (ch) {
+            case 'K': parsed.castlingRights |= WHITE_KINGSIDE; break;
+            case 'Q': parsed.castlingRights |= WHITE_QUEENSIDE; break;
+            case 'k': parsed.castlingRights |= BLACK_KINGSIDE; break;
+            case 'q': parsed.castlingRights |= BLACK_QUEENSIDE; break;
+            case '-': break;
+            default: return false;
         }
-        cout << "\n";
     }
     
-    bool isPathClear(pair<int,int> from, pair<int,int> to) {
-        int rowDiff = to.first - from.first;
-        int colDiff = to.second - from.second;
-        
-        int rowDir = (rowDiff == 0) ? 0 : (rowDiff > 0) ? 1 : -1;
-        int colDir = (colDiff == 0) ? 0 : (colDiff > 0) ? 1 : -1;
-        
-        int currentRow = from.first + rowDir;
-        int currentCol = from.second + colDir;
-        
-        while (currentRow != to.first || currentCol != to.second) {
-            if (board[currentRow][currentCol] != nullptr) {
-                return false;
-            }
-            currentRow += rowDir;
-            currentCol += colDir;
+    parsed.epSquare = NO_SQUARE;
+    if (enPassant != "-") {
+        if (enPassant.size() != 2 || enPassant[0] < 'a' || enPassant[0] > 'h' ||
+            (enPassant[1] != '3' && enPassant[1] != '6')) return false;
+        int epSq = toSquare('8' - enPassant[1], enPassant[0] - 'a');
+        int pawnSq = epSq + (parsed.sideToMove == WHITE ? 8 : -8);
+        if (canCaptureEnPassant(parsed, pawnSq, parsed.sideToMove)) {
+            parsed.epSquare = epSq;
         }
-        
-        return true;
     }
     
-    bool isInCheck(Color color) {
-        pair<int,int> kingPos = findKing(color);
-        if (kingPos.first == -1) return false;
-        
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr && board[i][j]->color != color) {
-                    if (board[i][j]->isValidMove({i, j}, kingPos, board) &&
-                        (board[i][j]->getType() == "Knight" || isPathClear({i, j}, kingPos))) {
-                        return true;
-                    }
-                }
+    int halfmoves = 0, fullmoves = 0;
+    if (in >> halfmoves) parsed.halfmoveClock = halfmoves;
+    parsed.fullmoveNumber = (in >> fullmoves) ? max(1, fullmoves) : 1;
+    
+    parsed.hash = computeHash(parsed);
+    pos = parsed;
+    return true;
+}
+
+// Counts leaf nodes of the legal move tree; the standard way to validate move generation
+uint64_t perft(const Position& pos, int depth) {
+    if (depth == 0) return 1;
+    
+    MoveList moves;
+    generateLegalMoves(pos, moves);
+    if (depth == 1) return moves.count;
+    
+    uint64_t nodes = 0;
+    for (int i = 0; i < moves.count; i++) {
+        Position next = pos;
+        applyMove(next, moves.moves[i]);
+        nodes += perft(next, depth - 1);
+    }
+    return nodes;
+}
+
+// Checks perft against the published counts for the standard test positions, which
+// between them cover castling, en passant, promotions and discovered checks
+bool runPerftCheck() {
+    struct PerftCase {
+        const char* fen;
+        int depth;
+        uint64_t nodes;
+    };
+    static const PerftCase CASES[] = {
+        {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", 5, 4865609},
+        {"r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", 4, 4085603},
+        {"8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", 5, 674624},
+        {"r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", 4, 422333},
+        {"rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", 4, 2103487},
+        {"r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", 4, 3894594},
+    };
+    
+    int failures = 0;
+    for (const PerftCase& test : CASES) {
+        Position pos;
+        uint64_t nodes = parseFen(test.fen, pos) ? perft(pos, test.depth) : 0;
+        bool ok = nodes == test.nodes;
+        failures += !ok;
+        cout << (ok ? "ok   " : "FAIL ") << "depth " << test.depth << " " << setw(9) << nodes
+             << " (expected " << test.nodes << ")  " << test.fen << "\n";
+    }
+    if (failures != 0) {
+        cout << "\n*** ERROR: " << failures << " perft position(s) gave the wrong count ***\n";
+        return false;
+    }
+    cout << "All perft counts match\n";
+    return true;
+}
+
+inline string squareName(int sq) {
+    return string(1, (char)('a' + colOf(sq))) + (char)('8' - rowOf(sq));
+}
+
+string toFen(const Position& pos) {
+    static const char LETTERS[] = " PNBRQK";
+    string fen;
+    for (int row = 0; row < 8; row++) {
+        int empty = 0;
+        for (int col = 0; col < 8; col++) {
+            Piece piece = pos.squares[toSquare(row, col)];
+            if (piece == EMPTY) {
+                empty++;
+                continue;
             }
+            if (empty > 0) fen += (char)('0' + empty);
+            empty = 0;
+            char letter = LETTERS[typeOf(piece)];
+            fen += (colorOf(piece) == WHITE) ? letter : (char)tolower(letter);
         }
-        return false;
+        if (empty > 0) fen += (char)('0' + empty);
+        if (row < 7) fen += '/';
     }
     
-    pair<int,int> findKing(Color color) {
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr && 
-                    board[i][j]->getType() == "King" && 
-                    board[i][j]->color == color) {
-                    return {i, j};
+    fen += (pos.sideToMove == WHITE) ? " w " : " b ";
+    if (pos.castlingRights == 0) fen += '-';
+    if (pos.castlingRights & WHITE_KINGSIDE) fen += 'K';
+    if (pos.castlingRights & WHITE_QUEENSIDE) fen += 'Q';
+    if (pos.castlingRights & BLACK_KINGSIDE) fen += 'k';
+    if (pos.castlingRights & BLACK_QUEENSIDE) fen += 'q';
+    fen += ' ';
+    fen += (pos.epSquare == NO_SQUARE) ? string("-") : squareName(pos.epSquare);
+    fen += ' ' + to_string(pos.halfmoveClock) + ' ' + to_string(pos.fullmoveNumber);
+    return fen;
+}
+
+// Standard algebraic notation for a legal move, as used in PGN
+string toSan(const Position& pos, Move move) {
+    int from = moveFrom(move), to = moveTo(move);
+    Piece piece = pos.squares[from];
+    PieceType type = typeOf(piece);
+    string san;
+    
+    if (type == KING && abs(colOf(to) - colOf(from)) == 2) {
+        san = (colOf(to) > colOf(from)) ? "O-O" : "O-O-O";
+    } else {
+        bool capture = pos.squares[to] != EMPTY || (type == PAWN && to == pos.epSquare);
+        if (type == PAWN) {
+            if (capture) san += (char)('a' + colOf(from));
+        } else {
+            san += " PNBRQK"[type];
+            // Name the file, rank or both when another piece of the same kind can also reach 'to'
+            MoveList legal;
+            generateLegalMoves(pos, legal);
+            bool ambiguous = false, sameFile = false, sameRow = false;
+            for (int i = 0; i < legal.count; i++) {
+                int other = moveFrom(legal.moves[i]);
+                if (moveTo(legal.moves[i]) == to && other != from && pos.squares[other] == piece) {
+                    ambiguous = true;
+                    sameFile |= colOf(other) == colOf(from);
+                    sameRow |= rowOf(other) == rowOf(from);
                 }
             }
+            if (ambiguous) {
+                if (!sameFile) san += (char)('a' + colOf(from));
+                else if (!sameRow) san += (char)('8' - rowOf(from));
+                else san += squareName(from);
+            }
+        }
+        if (capture) san += 'x';
+        san += squareName(to);
+        if (movePromotion(move) != NO_TYPE) {
+            san += '=';
+            san += " PNBRQK"[movePromotion(move)];
         }
-        return {-1, -1};
     }
     
-    bool wouldBeInCheck(pair<int,int> from, pair<int,int> to, Color color) {
-        Piece* temp = board[to.first][to.second];
-        board[to.first][to.second] = board[from.first][from.second];
-        board[from.first][from.second] = nullptr;
-        
-        bool inCheck = isInCheck(color);
-        
-        board[from.first][from.second] = board[to.first][to.second];
-        board[to.first][to.second] = temp;
-        
-        return inCheck;
+    Position next = pos;
+    applyMove(next, move);
+    if (isInCheck(next, next.sideToMove)) {
+        san += hasLegalMove(next) ? '+' : '#';
     }
-    
-    bool isCheckmate(Color color) {
-        if (!isInCheck(color)) return false;
-        
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr && board[i][j]->color == color) {
-                    vector<pair<int,int>> moves = board[i][j]->getPossibleMoves({i, j}, board);
-                    for (auto move : moves) {
-                        if (!wouldBeInCheck({i, j}, move, color)) {
-                            return false;
-                        }
-                    }
-                }
-            }
+    return san;
+}
+
+// Engine: material plus simple placement bonuses, searched with iterative-deepening alpha-beta
+const int PIECE_VALUES[7] = {0, 100, 320, 330, 500, 900, 0};
+const int MATE_SCORE = 30000;
+const int INFINITE_SCORE = 32000;
+const int MAX_PLY = 64;
+
+inline bool isMateScore(int score) { return abs(score) >= MATE_SCORE - MAX_PLY; }
+
+// Static evaluation from the side to move's point of view, in centipawns
+int evaluate(const Position& pos) {
+    int score = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        Piece piece = pos.squares[sq];
+        if (piece == EMPTY) continue;
+        
+        int row = rowOf(sq), col = colOf(sq);
+        int centrality = min(row, 7 - row) + min(col, 7 - col);   // 0 in a corner, 6 in the centre
+        int value = PIECE_VALUES[typeOf(piece)];
+        switch (typeOf(piece)) {
+            case PAWN:   value += 6 * (colorOf(piece) == WHITE ? 6 - row : row - 1); break;
+            case KNIGHT:
+            case BISHOP: value += 5 * centrality; break;
+            case QUEEN:  value += 2 * centrality; break;
+            default: break;
         }
-        return true;
+        score += (colorOf(piece) == WHITE) ? value : -value;
     }
+    return (pos.sideToMove == WHITE) ? score : -score;
+}
+
+struct SearchLimits {
+    int depth = MAX_PLY;
+    uint64_t nodes = 0;      // 0 means no node limit
+    int moveTimeMs = 0;      // 0 means no time limit
+    int timeLeftMs = 0;      // the mover's clock, 0 when not playing on a clock
+    int incrementMs = 0;
+    int movesToGo = 0;       // moves to the next time control, 0 when the clock must last the game
+    uint64_t nodesPerMs = 0; // virtual time: when set, time is counted as nodes searched / nodesPerMs
+};
+
+// Splits a clock over the game. Each move gets an optimum time, which every completed
+// iteration stretches or shortens by how settled the search looks, and a hard maximum
+// it never passes. A fixed move time serves as both.
+class TimeManager {
+private:
+    static constexpr int MOVE_OVERHEAD_MS = 10;     // kept back for getting the move onto the clock
+    static constexpr int DEFAULT_MOVES_TO_GO = 30;
+    static constexpr int FAIL_LOW_MARGIN = 30;
+    
+    chrono::steady_clock::time_point startTime;
+    uint64_t nodesPerMs = 0;
+    bool active = false;
+    bool adaptive = false;
+    double optimumMs = 0;
+    double maximumMs = 0;
+    double softMs = 0;                  // optimum after the adjustments
+    bool hasPrevious = false;
+    Move previousBest = 0;
+    int previousScore = 0;
+    int stableIterations = 0;
+    bool failingLow = false;
+    double lastCheckMs = 0;             // when outOfTime() last ran
+    double longestGapMs = 0;            // longest time between two of its runs
+    double marginMs = 0;                // stop this far short of the limit, for being preempted near it
+    bool nearLimit = false;             // close enough to the limit to check more often
     
-    bool isStalemate(Color color) {
-        if (isInCheck(color)) return false;
+public:
+    void start(const SearchLimits& limits) {
+        startTime = chrono::steady_clock::now();
+        nodesPerMs = limits.nodesPerMs;
+        hasPrevious = false;
+        stableIterations = 0;
+        failingLow = false;
+        lastCheckMs = 0;
+        longestGapMs = 0;
+        nearLimit = false;
+        adaptive = limits.timeLeftMs > 0;
+        active = adaptive || limits.moveTimeMs > 0;
         
-        for (int i = 0; i < 8; i++) {
-            for (int j = 0; j < 8; j++) {
-                if (board[i][j] != nullptr && board[i][j]->color == color) {
-                    vector<pair<int,int>> moves = board[i][j]->getPossibleMoves({i, j}, board);
-                    for (auto move : moves) {
-                        if (!wouldBeInCheck({i, j}, move, color)) {
-                            return false;
-                        }
-                    }
-                }
-            }
+        if (adaptive) {
+            double available = max(1, limits.timeLeftMs - MOVE_OVERHEAD_MS);
+            int movesToGo = limits.movesToGo > 0 ? min(limits.movesToGo, 50) : DEFAULT_MOVES_TO_GO;
+            double share = available / movesToGo + limits.incrementMs * 0.75;
+            maximumMs = min(available * 0.8, share * 4);
+            optimumMs = min(maximumMs, share);
+        } else {
+            optimumMs = maximumMs = limits.moveTimeMs;
         }
-        return true;
+        marginMs = min<double>(MOVE_OVERHEAD_MS, maximumMs / 2);
+        softMs = optimumMs;
     }
     
-    bool isValidMove(pair<int,int> from, pair<int,int> to) {
-        if (from.first < 0 || from.first >= 8 || from.second < 0 || from.second >= 8 ||
-            to.first < 0 || to.first >= 8 || to.second < 0 || to.second >= 8) {
-            return false;
-        }
+    double elapsedMs(uint64_t nodes) const {
+        if (nodesPerMs != 0) return double(nodes) / nodesPerMs;
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+    }
+    
+    // Checked during an iteration. One whose first root move failed low may run on to
+    // the maximum looking for a better move. The search stops a fixed margin plus the
+    // longest gap between checks so far short of the limit, so on a loaded machine, where
+    // the thread waits to be scheduled, it stops correspondingly earlier.
+    bool outOfTime(uint64_t nodes) {
+        if (!active) return false;
+        double now = elapsedMs(nodes);
+        longestGapMs = max(longestGapMs, now - lastCheckMs);
+        lastCheckMs = now;
+        double left = (failingLow ? maximumMs : softMs) - marginMs - now;
+        nearLimit = left < 4 * longestGapMs;
+        return left <= longestGapMs;
+    }
+    
+    // Nodes to search before the next outOfTime(): fewer once the limit is close
+    int checkInterval() const { return nearLimit ? 128 : 1024; }
+    
+    // The first root move, last iteration's best, came back with 'score'
+    void firstRootMove(int score) {
+        failingLow = adaptive && hasPrevious && score < previousScore - FAIL_LOW_MARGIN;
+    }
+    
+    // Rescales the budget after an iteration and says whether to start another. A changed
+    // best move, a score drop or a fail-low buys time; a best move that keeps winning gives it back.
+    bool iterationDone(Move best, int score, uint64_t nodes) {
+        if (!adaptive) return true;
         
-        Piece* piece = board[from.first][from.second];
-        if (piece == nullptr) return false;
+        stableIterations = (hasPrevious && best == previousBest) ? stableIterations + 1 : 0;
+        double stability = max(0.5, 1.4 - 0.15 * stableIterations);
+        double drop = hasPrevious ? clamp(1.0 + (previousScore - score) / 150.0, 0.8, 2.0) : 1.0;
+        double failLow = failingLow ? 1.3 : 1.0;
+        softMs = min(maximumMs, optimumMs * stability * drop * failLow);
         
-        if (board[to.first][to.second] != nullptr && 
-            board[to.first][to.second]->color == piece->color) {
-            return false;
-        }
+        hasPrevious = true;
+        previousBest = best;
+        previousScore = score;
+        failingLow = false;
         
-        if (!piece->isValidMove(from, to, board)) {
-            return false;
+        // The next iteration takes several times as long as this one, so only start it with time to finish
+        return elapsedMs(nodes) < softMs * 0.5;
+    }
+    
+    double maximum() const { return maximumMs; }
+};
+
+struct SearchResult {
+    Move bestMove = 0;
+    int score = 0;
+    int depth = 0;
+    uint64_t nodes = 0;
+    bool stoppedByTime = false;   // time ran out, rather than depth, nodes or a forced mate ending it
+};
+
+// One root move with its score from the last completed iteration
+struct RootMove {
+    Move move;
+    int score;
+};
+
+enum Bound : uint8_t { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
+
+struct TTEntry {
+    uint64_t key;
+    int16_t score;
+    uint8_t depth;
+    uint8_t bound;
+    Move move;
+};
+
+class Search {
+private:
+    TTEntry* table;                  // transposition table, size a power of two, held in an arena
+    size_t tableMask;
+    int history[16][64];             // quiet-move ordering: beta cutoffs by piece and destination
+    KeyHistory keys;                 // hashes from the game start down to the current node
+    SearchLimits limits;
+    TimeManager time;
+    uint64_t nodes;
+    bool stopped;
+    bool canStop;                    // an iteration has completed, so there is a move to fall back on
+    bool timeUp;                     // the time manager ended the search
+    uint64_t nextCheck;              // node count at which checkLimits() runs next
+    atomic<bool> stopRequested{false};   // set from another thread to abort the search
+    atomic<bool> pondering{false};       // limits are ignored until the ponder move is played
+    Move rootBestMove;
+    
+    // Mate scores are stored relative to the node so they stay valid at any ply
+    static int scoreToTT(int score, int ply) {
+        return score >= MATE_SCORE - MAX_PLY ? score + ply : score <= -(MATE_SCORE - MAX_PLY) ? score - ply : score;
+    }
+    static int scoreFromTT(int score, int ply) {
+        return score >= MATE_SCORE - MAX_PLY ? score - ply : score <= -(MATE_SCORE - MAX_PLY) ? score + ply : score;
+    }
+    
+    void checkLimits() {
+        nextCheck = nodes + 1024;
+        if (stopRequested) {
+            stopped = true;
+            return;
         }
-        
-        // FIXED: Only check path for sliding pieces, not knights
-        if (piece->getType() != "Knight" && !isPathClear(from, to)) {
-            return false;
+        if (!canStop) return;
+        bool outOfTime = time.outOfTime(nodes);   // asked even while pondering to keep its check timing current
+        nextCheck = nodes + time.checkInterval();
+        if (pondering) return;
+        if (limits.nodes != 0 && nodes >= limits.nodes) {
+            stopped = true;
+        }
+        if (outOfTime) {
+            stopped = true;
+            timeUp = true;
+        }
+    }
+    
+    // Draw by repetition inside the search: one earlier occurrence since the last irreversible move is enough
+    bool isRepetition(const Position& pos) {
+        int last = (int)keys.size() - 1;
+        int oldest = max(0, (int)keys.size() - (int)pos.halfmoveClock);
+        for (int i = last - 1; i >= oldest; i -= 2) {
+            if (keys[i] == pos.hash) return true;
         }
+        return false;
+    }
+    
+    int scoreMove(const Position& pos, Move move, Move ttMove) {
+        if (move == ttMove) return 1 << 30;
         
-        return true;
+        Piece mover = pos.squares[moveFrom(move)];
+        Piece victim = pos.squares[moveTo(move)];
+        if (typeOf(mover) == PAWN && moveTo(move) == pos.epSquare) victim = makePiece(opposite(colorOf(mover)), PAWN);
+        
+        // Captures and promotions first, most valuable victim by least valuable attacker
+        if (victim != EMPTY || movePromotion(move) != NO_TYPE) {
+            return (1 << 24) + 16 * (PIECE_VALUES[typeOf(victim)] + PIECE_VALUES[movePromotion(move)]) - PIECE_VALUES[typeOf(mover)] / 10;
+        }
+        return history[mover][moveTo(move)];
     }
     
-    string expandDirection(string shortDir) {
-        map<string, string> directionMap = {
-            {"U", "up"}, {"D", "down"}, {"L", "left"}, {"R", "right"},
-            {"SLU", "slantleftup"}, {"SLD", "slantleftdown"},
-            {"SRU", "slantrightup"}, {"SRD", "slantrightdown"},
-            {"UL", "upleft"}, {"UR", "upright"}, {"LU", "leftup"}, {"LD", "leftdown"},
-            {"RU", "rightup"}, {"RD", "rightdown"}, {"DL", "downleft"}, {"DR", "downright"},
-            {"CL", "castle-left"}, {"CR", "castle-right"}
-        };
+    // Moves the best-scoring remaining move to position 'index'
+    static void pickMove(MoveList& moves, int* scores, int index) {
+        int best = index;
+        for (int i = index + 1; i < moves.count; i++) {
+            if (scores[i] > scores[best]) best = i;
+        }
+        swap(moves.moves[index], moves.moves[best]);
+        swap(scores[index], scores[best]);
+    }
+    
+    int quiesce(const Position& pos, int ply, int alpha, int beta) {
+        if (++nodes >= nextCheck) checkLimits();
+        if (stopped) return 0;
+        
+        int standPat = evaluate(pos);
+        if (ply >= MAX_PLY || standPat >= beta) return standPat;
+        if (standPat > alpha) alpha = standPat;
         
-        auto it = directionMap.find(shortDir);
-        return (it != directionMap.end()) ? it->second : shortDir;
-    }
-    
-    pair<int,int> parseDirection(string direction, pair<int,int> from, int steps) {
-        pair<int,int> to = from;
-        
-        if (direction == "up") {
-            to.first -= steps;
-        } else if (direction == "down") {
-            to.first += steps;
-        } else if (direction == "left") {
-            to.second -= steps;
-        } else if (direction == "right") {
-            to.second += steps;
-        } else if (direction == "slantrightup") {
-            to.first -= steps; to.second += steps;
-        } else if (direction == "slantleftup") {
-            to.first -= steps; to.second -= steps;
-        } else if (direction == "slantrightdown") {
-            to.first += steps; to.second += steps;
-        } else if (direction == "slantleftdown") {
-            to.first += steps; to.second -= steps;
-        } else if (direction == "upleft") {
-            to.first -= 2; to.second--;
-        } else if (direction == "upright") {
-            to.first -= 2; to.second++;
-        } else if (direction == "leftup") {
-            to.first--; to.second -= 2;
-        } else if (direction == "leftdown") {
-            to.first++; to.second -= 2;
-        } else if (direction == "rightup") {
-            to.first--; to.second += 2;
-        } else if (direction == "rightdown") {
-            to.first++; to.second += 2;
-        } else if (direction == "downleft") {
-            to.first += 2; to.second--;
-        } else if (direction == "downright") {
-            to.first += 2; to.second++;
-        }
-        
-        return to;
-    }
-    
-    bool canCastle(Color color, bool kingside) {
-        if (color == WHITE) {
-            if (whiteKingMoved) return false;
-            if (kingside && whiteRookRightMoved) return false;
-            if (!kingside && whiteRookLeftMoved) return false;
-            
-            int rookCol = kingside ? 7 : 0;
-            if (board[7][rookCol] == nullptr || board[7][rookCol]->getType() != "Rook") return false;
-            
-            // Check if path is clear
-            int start = kingside ? 5 : 1;
-            int end = kingside ? 6 : 3;
-            for (int i = start; i <= end; i++) {
-                if (board[7][i] != nullptr) return false;
-            }
-            
-            // Check if king would be in check during castling
-            for (int i = 4; i <= (kingside ? 6 : 2); i++) {
-                if (wouldBeInCheck({7, 4}, {7, i}, color)) return false;
+        // Only captures and promotions are searched here
+        MoveList moves;
+        generateMoves(pos, moves);
+        int scores[256];
+        int kept = 0;
+        for (int i = 0; i < moves.count; i++) {
+            int score = scoreMove(pos, moves.moves[i], 0);
+            if (score >= (1 << 24)) {
+                moves.moves[kept] = moves.moves[i];
+                scores[kept++] = score;
             }
-        } else {
-            if (blackKingMoved) return false;
-            if (kingside && blackRookRightMoved) return false;
-            if (!kingside && blackRookLeftMoved) return false;
+        }
+        moves.count = kept;
+        
+        for (int i = 0; i < moves.count; i++) {
+            pickMove(moves, scores, i);
+            if (wouldBeInCheck(pos, moves.moves[i])) continue;
+            
+            Position next = pos;
+            applyMove(next, moves.moves[i]);
+            int score = -quiesce(next, ply + 1, -beta, -alpha);
+            if (stopped) return 0;
             
-            int rookCol = kingside ? 7 : 0;
-            if (board[0][rookCol] == nullptr || board[0][rookCol]->getType() != "Rook") return false;
+            if (score >= beta) return score;
+            if (score > alpha) alpha = score;
+        }
+        return alpha;
+    }
+    
+    void startSearch(const Position& root, const SearchLimits& searchLimits, const KeyHistory& gameHistory) {
+        limits = searchLimits;
+        time.start(limits);
+        nodes = 0;
+        stopped = false;
+        canStop = false;
+        timeUp = false;
+        nextCheck = 1024;
+        
+        keys.assign(gameHistory);
+        if (!keys.empty() && keys.back() == root.hash) keys.pop_back();
+    }
+    
+    // One iteration over all root moves. The first 'lines' moves get exact scores and are kept
+    // sorted at the front; every later move is first tested with a null window against the
+    // weakest of them and only searched in full if it beats it.
+    void searchRoot(const Position& root, int depth, int lines, vector<RootMove>& rootMoves) {
+        keys.push_back(root.hash);
+        for (int i = 0; i < (int)rootMoves.size(); i++) {
+            Position next = root;
+            applyMove(next, rootMoves[i].move);
             
-            // Check if path is clear
-            int start = kingside ? 5 : 1;
-            int end = kingside ? 6 : 3;
-            for (int i = start; i <= end; i++) {
-                if (board[0][i] != nullptr) return false;
+            int score;
+            if (i < lines) {
+                score = -negamax(next, depth - 1, 1, -INFINITE_SCORE, INFINITE_SCORE);
+            } else {
+                int threshold = rootMoves[lines - 1].score;
+                score = -negamax(next, depth - 1, 1, -threshold - 1, -threshold);
+                if (score > threshold && !stopped) {
+                    score = -negamax(next, depth - 1, 1, -INFINITE_SCORE, INFINITE_SCORE);
+                }
             }
+            if (stopped) break;
+            rootMoves[i].score = score;
             
-            // Check if king would be in check during castling
-            for (int i = 4; i <= (kingside ? 6 : 2); i++) {
-                if (wouldBeInCheck({0, 4}, {0, i}, color)) return false;
+            if (i == lines - 1) {
+                stable_sort(rootMoves.begin(), rootMoves.begin() + lines,
+                            [](const RootMove& a, const RootMove& b) { return a.score > b.score; });
+            } else if (i >= lines && score > rootMoves[lines - 1].score) {
+                // Slot the new line into the sorted front, pushing the old weakest one out
+                int slot = 0;
+                while (rootMoves[slot].score >= score) slot++;
+                rotate(rootMoves.begin() + slot, rootMoves.begin() + i, rootMoves.begin() + i + 1);
             }
         }
-        
-        return true;
+        keys.pop_back();
     }
-
-    bool makeMove(string pieceCode, string direction, int steps) {
-        if (piecePositions.find(pieceCode) == piecePositions.end()) {
-            cout << "\n*** ERROR: Piece '" << pieceCode << "' not found! ***\n";
-            return false;
-        }
+    
+    int negamax(const Position& pos, int depth, int ply, int alpha, int beta) {
+        if (ply > 0 && (pos.halfmoveClock >= 100 || isRepetition(pos))) return 0;
+        if (depth <= 0) return quiesce(pos, ply, alpha, beta);
         
-        pair<int,int> from = piecePositions[pieceCode];
-        Piece* piece = board[from.first][from.second];
+        if (++nodes >= nextCheck) checkLimits();
+        if (stopped) return 0;
+        if (ply >= MAX_PLY) return evaluate(pos);
         
-        if (piece->color != currentTurn) {
-            cout << "\n*** ERROR: It's not your turn! ***\n";
-            return false;
+        TTEntry& entry = table[pos.hash & tableMask];
+        Move ttMove = 0;
+        if (entry.key == pos.hash) {
+            ttMove = entry.move;
+            int score = scoreFromTT(entry.score, ply);
+            if (ply > 0 && entry.depth >= depth &&
+                (entry.bound == BOUND_EXACT ||
+                 (entry.bound == BOUND_LOWER && score >= beta) ||
+                 (entry.bound == BOUND_UPPER && score <= alpha))) {
+                return score;
+            }
         }
         
-        pair<int,int> to;
+        bool inCheck = isInCheck(pos, pos.sideToMove);
+        MoveList moves;
+        generateMoves(pos, moves);
+        int scores[256];
+        for (int i = 0; i < moves.count; i++) {
+            scores[i] = scoreMove(pos, moves.moves[i], ttMove);
+        }
         
-        // Handle castling
-        if (piece->getType() == "King" && (direction == "castle-left" || direction == "castle-right")) {
-            bool kingside = (direction == "castle-right");
-            if (!canCastle(currentTurn, kingside)) {
-                cout << "\n*** ERROR: Cannot castle! ***\n";
-                return false;
-            }
-            
-            if (currentTurn == WHITE) {
-                to = {7, kingside ? 6 : 2};
-                // Move rook first
-                if (kingside) {
-                    board[7][5] = board[7][7];
-                    board[7][7] = nullptr;
-                } else {
-                    board[7][3] = board[7][0];
-                    board[7][0] = nullptr;
-                }
-            } else {
-                to = {0, kingside ? 6 : 2};
-                // Move rook first
-                if (kingside) {
-                    board[0][5] = board[0][7];
-                    board[0][7] = nullptr;
-                } else {
-                    board[0][3] = board[0][0];
-                    board[0][0] = nullptr;
-                }
-            }
-            
-            // Move king to castling position
-            board[to.first][to.second] = piece;
-            board[from.first][from.second] = nullptr;
-            piece->hasMoved = true;
+        int originalAlpha = alpha;
+        int best = -INFINITE_SCORE;
+        Move bestMove = 0;
+        int legal = 0;
+        
+        keys.push_back(pos.hash);
+        for (int i = 0; i < moves.count; i++) {
+            pickMove(moves, scores, i);
+            Move move = moves.moves[i];
             
-            // Update castling flags
-            if (currentTurn == WHITE) {
-                whiteKingMoved = true;
-                if (kingside) whiteRookRightMoved = true;
-                else whiteRookLeftMoved = true;
-            } else {
-                blackKingMoved = true;
-                if (kingside) blackRookRightMoved = true;
-                else blackRookLeftMoved = true;
-            }
+            Position next = pos;
+            applyMove(next, move);
+            if (isInCheck(next, pos.sideToMove)) continue;
+            legal++;
             
-            updatePiecePositions();
+            int score = -negamax(next, depth - 1, ply + 1, -beta, -alpha);
+            if (stopped) break;
+            if (ply == 0 && legal == 1) time.firstRootMove(score);
             
-            // Check for check/checkmate
-            Color oppositeColor = (currentTurn == WHITE) ? BLACK : WHITE;
-            if (isInCheck(oppositeColor)) {
-                cout << "\n*** CHECK! ***\n";
-                if (isCheckmate(oppositeColor)) {
-                    cout << "\n*** CHECKMATE! " << (currentTurn == WHITE ? "White" : "Black") << " wins! ***\n";
-                    return true;
+            if (score > best) {
+                best = score;
+                bestMove = move;
+                if (score > alpha) {
+                    alpha = score;
+                    if (ply == 0) rootBestMove = move;
+                    if (alpha >= beta) {
+                        if (scores[i] < (1 << 24)) {
+                            history[pos.squares[moveFrom(move)]][moveTo(move)] += depth * depth;
+                        }
+                        break;
+                    }
                 }
-            } else if (isStalemate(oppositeColor)) {
-                cout << "\n*** STALEMATE! It's a draw! ***\n";
-                return true;
             }
+        }
+        keys.pop_back();
+        
+        if (stopped) return 0;
+        if (legal == 0) return inCheck ? -(MATE_SCORE - ply) : 0;
+        
+        entry.key = pos.hash;
+        entry.score = (int16_t)scoreToTT(best, ply);
+        entry.depth = (uint8_t)depth;
+        entry.bound = best >= beta ? BOUND_LOWER : best > originalAlpha ? BOUND_EXACT : BOUND_UPPER;
+        entry.move = bestMove;
+        return best;
+    }
+    
+public:
+    // The table is carved out of 'arena' and lives as long as the arena's current contents
+    Search(Arena& arena, int ttBits = 16)
+        : table(arena.allocateArray<TTEntry>(size_t(1) << ttBits)),
+          tableMask((size_t(1) << ttBits) - 1) {
+        clear();
+    }
+    
+    // Arena space for a Search and its table
+    static size_t arenaBytes(int ttBits) {
+        return sizeof(Search) + alignof(Search) + (sizeof(TTEntry) << ttBits) + alignof(TTEntry);
+    }
+    
+    // Forgets everything learned, e.g. between games
+    void clear() {
+        fill(table, table + tableMask + 1, TTEntry{});
+        memset(history, 0, sizeof(history));
+    }
+    
+    // Searches 'root' within the limits. 'gameHistory' holds the hashes of the positions
+    // played so far so repetitions of earlier positions are scored as draws.
+    SearchResult think(const Position& root, const SearchLimits& searchLimits, const KeyHistory& gameHistory) {
+        startSearch(root, searchLimits, gameHistory);
+        
+        SearchResult result;
+        MoveList rootMoves;
+        generateLegalMoves(root, rootMoves);
+        if (rootMoves.count == 0) return result;
+        result.bestMove = rootMoves.moves[0];
+        
+        for (int depth = 1; depth <= limits.depth && depth < MAX_PLY; depth++) {
+            rootBestMove = 0;
+            int score = negamax(root, depth, 0, -INFINITE_SCORE, INFINITE_SCORE);
+            if (stopped) break;
             
-            // Check for 50-move rule
-            if (movesSinceCapture >= 100) {
-                cout << "\n*** DRAW by 50-move rule! ***\n";
-                return true;
+            result.depth = depth;
+            result.score = score;
+            if (rootBestMove != 0) result.bestMove = rootBestMove;
+            canStop = true;
+            checkLimits();
+            if (stopped || isMateScore(score)) break;
+            // While pondering the budget keeps adapting but only applies after the ponder hit
+            bool another = time.iterationDone(result.bestMove, score, nodes);
+            if (!another && !pondering) {
+                timeUp = true;
+                break;
             }
-            
-            currentTurn = oppositeColor;
-            return false;
-        } else {
-            to = parseDirection(direction, from, steps);
         }
         
-        if (to.first < 0 || to.first >= 8 || to.second < 0 || to.second >= 8) {
-            cout << "\n*** ERROR: Invalid move - out of bounds! ***\n";
-            return false;
+        result.nodes = nodes;
+        result.stoppedByTime = timeUp;
+        return result;
+    }
+    
+    // Multi-PV search: returns the best 'lines' root moves with exact scores, best first.
+    // All lines share one iterative deepening, transposition table and move ordering, so
+    // the cost grows far more slowly than running 'lines' separate searches.
+    vector<RootMove> analyse(const Position& root, const SearchLimits& searchLimits,
+                             const KeyHistory& gameHistory, int lines, int* depthReached = nullptr) {
+        startSearch(root, searchLimits, gameHistory);
+        
+        MoveList legal;
+        generateLegalMoves(root, legal);
+        vector<RootMove> rootMoves;
+        for (int i = 0; i < legal.count; i++) {
+            rootMoves.push_back({legal.moves[i], -INFINITE_SCORE});
         }
+        lines = min(max(lines, 1), (int)rootMoves.size());
         
-        if (!isValidMove(from, to)) {
-            cout << "\n*** ERROR: Invalid move! ***\n";
-            return false;
+        vector<RootMove> completed = rootMoves;
+        if (depthReached != nullptr) *depthReached = 0;
+        for (int depth = 1; lines > 0 && depth <= limits.depth && depth < MAX_PLY; depth++) {
+            searchRoot(root, depth, lines, rootMoves);
+            if (stopped) break;
+            
+            // The next iteration starts from the best moves found so far
+            stable_sort(rootMoves.begin() + lines, rootMoves.end(),
+                        [](const RootMove& a, const RootMove& b) { return a.score > b.score; });
+            completed = rootMoves;
+            if (depthReached != nullptr) *depthReached = depth;
+            canStop = true;
+            checkLimits();
+            if (stopped) break;
         }
         
-        // Only check path for sliding pieces, not knights
-        if (piece->getType() != "Knight" && !isPathClear(from, to)) {
-            cout << "\n*** ERROR: Path blocked! ***\n";
+        completed.resize(lines);
+        return completed;
+    }
+    
+    // Exact scores for every legal move, best first
+    vector<RootMove> scoreAllMoves(const Position& root, const SearchLimits& searchLimits,
+                                   const KeyHistory& gameHistory, int* depthReached = nullptr) {
+        // analyse() clamps the line count to the number of legal moves
+        return analyse(root, searchLimits, gameHistory, 256, depthReached);
+    }
+    
+    uint64_t nodeCount() const { return nodes; }
+    
+    // The move the transposition table expects in 'pos', or 0 if it has none that is legal
+    Move expectedMove(const Position& pos) const {
+        const TTEntry& entry = table[pos.hash & tableMask];
+        if (entry.key != pos.hash || entry.move == 0) return 0;
+        
+        MoveList legal;
+        generateLegalMoves(pos, legal);
+        return find(legal.moves, legal.moves + legal.count, entry.move) != legal.moves + legal.count ? entry.move : 0;
+    }
+    
+    // Cross-thread controls for pondering. A search started while pondering runs until
+    // ponderHit() lets its limits apply (time spent so far counts) or stop() aborts it.
+    void startPondering() { stopRequested = false; pondering = true; }
+    void ponderHit() { pondering = false; }
+    void stop() { stopRequested = true; }
+    void resetSignals() { stopRequested = false; pondering = false; }
+};
+
+// Keeps a search running in the background on the position after the opponent's expected
+// reply. If the opponent plays it, the search carries on with its tree and table intact;
+// otherwise it is aborted and the table is still warm for the real search.
+class Ponderer {
+private:
+    Search* search;
+    thread worker;
+    Position ponderPosition;
+    KeyHistory ponderHistory;
+    Move predicted = 0;
+    SearchResult result;
+    
+public:
+    explicit Ponderer(Search* engine) : search(engine) {}
+    ~Ponderer() { cancel(); }
+    
+    void start(const Position& pos, Move reply, const SearchLimits& limits, const KeyHistory& history) {
+        cancel();
+        predicted = reply;
+        ponderPosition = pos;
+        applyMove(ponderPosition, reply);
+        ponderHistory.assign(history);
+        ponderHistory.push_back(ponderPosition.hash);
+        
+        search->startPondering();
+        worker = thread([this, limits] {
+            result = search->think(ponderPosition, limits, ponderHistory);
+        });
+    }
+    
+    // The opponent played 'move'. On a ponder hit waits for the search to use up its
+    // limits and returns its result; on a miss aborts it and returns false.
+    bool finish(Move move, SearchResult& found) {
+        if (!worker.joinable()) return false;
+        if (move != predicted) {
+            cancel();
             return false;
         }
+        search->ponderHit();
+        worker.join();
+        search->resetSignals();
+        found = result;
+        return found.bestMove != 0;
+    }
+    
+    void cancel() {
+        if (!worker.joinable()) return;
+        search->stop();
+        worker.join();
+        search->resetSignals();
+    }
+};
+
+// Direction tokens accepted on input, in short and long form. Sliding moves are
+// scaled by a step count; knight jumps and castling have fixed deltas.
+struct DirectionInfo {
+    string_view shortForm;
+    string_view longForm;
+    int rowDelta;
+    int colDelta;
+    bool needsSteps;
+};
+
+constexpr DirectionInfo DIRECTIONS[] = {
+    {"U", "up", -1, 0, true},               {"D", "down", 1, 0, true},
+    {"L", "left", 0, -1, true},             {"R", "right", 0, 1, true},
+    {"SLU", "slantleftup", -1, -1, true},   {"SLD", "slantleftdown", 1, -1, true},
+    {"SRU", "slantrightup", -1, 1, true},   {"SRD", "slantrightdown", 1, 1, true},
+    {"UL", "upleft", -2, -1, false},        {"UR", "upright", -2, 1, false},
+    {"LU", "leftup", -1, -2, false},        {"LD", "leftdown", 1, -2, false},
+    {"RU", "rightup", -1, 2, false},        {"RD", "rightdown", 1, 2, false},
+    {"DL", "downleft", 2, -1, false},       {"DR", "downright", 2, 1, false},
+    {"CL", "castle-left", 0, -2, false},    {"CR", "castle-right", 0, 2, false}
+};
+constexpr int DIRECTION_COUNT = sizeof(DIRECTIONS) / sizeof(DIRECTIONS[0]);
+constexpr int CASTLE_LEFT = 16, CASTLE_RIGHT = 17;
+constexpr int NO_DIRECTION = -1;
+
+static_assert(DIRECTIONS[CASTLE_LEFT].shortForm == "CL" && DIRECTIONS[CASTLE_RIGHT].shortForm == "CR",
+              "castling entries must match their indices");
+
+int findDirection(string_view token) {
+    for (int i = 0; i < DIRECTION_COUNT; i++) {
+        if (token == DIRECTIONS[i].shortForm || token == DIRECTIONS[i].longForm) {
+            return i;
+        }
+    }
+    return NO_DIRECTION;
+}
+
+// A direction may carry a promotion suffix such as "U=N". Strips it from the token and
+// returns the piece asked for: a queen when there is no suffix, NO_TYPE when it is unknown.
+PieceType splitPromotion(string_view& token) {
+    size_t mark = token.find('=');
+    if (mark == string_view::npos) return QUEEN;
+    
+    char letter = (mark + 1 < token.size()) ? token[mark + 1] : ' ';
+    token = token.substr(0, mark);
+    switch (letter) {
+        case 'Q': return QUEEN;
+        case 'R': return ROOK;
+        case 'B': return BISHOP;
+        case 'N': return KNIGHT;
+        default: return NO_TYPE;
+    }
+}
+
+// Unknown tokens still take a step count so input stays in sync; the move is rejected later
+inline bool directionNeedsSteps(int direction) {
+    return direction == NO_DIRECTION || DIRECTIONS[direction].needsSteps;
+}
+
+// Piece list: each of the 32 starting pieces keeps a fixed index for the whole game.
+// White pawns are 0-7 and White's back rank 8-15, Black's back rank 16-23 and pawns 24-31,
+// so an index maps straight back to its starting square.
+const int PIECE_COUNT = 32;
+
+const char* const PIECE_CODES[PIECE_COUNT] = {
+    "WP1", "WP2", "WP3", "WP4", "WP5", "WP6", "WP7", "WP8",
+    "WR1", "WN1", "WB1", "WQ",  "WKG", "WB2", "WN2", "WR2",
+    "BR1", "BN1", "BB1", "BQ",  "BKG", "BB2", "BN2", "BR2",
+    "BP1", "BP2", "BP3", "BP4", "BP5", "BP6", "BP7", "BP8"
+};
+
+inline int startSquareOf(int index) { return index < 16 ? index + 48 : index - 16; }
+
+inline PieceType codeTypeOf(int index) {
+    switch (PIECE_CODES[index][1]) {
+        case 'P': return PAWN;
+        case 'N': return KNIGHT;
+        case 'B': return BISHOP;
+        case 'R': return ROOK;
+        case 'Q': return QUEEN;
+        default:  return KING;
+    }
+}
+
+// Maps a user-facing code to its piece-list index without any lookups, or -1 if unknown
+int pieceIndexOf(const string& code) {
+    if (code.size() < 2 || code.size() > 3) return -1;
+    
+    bool white = (code[0] == 'W');
+    if (!white && code[0] != 'B') return -1;
+    int backRank = white ? 8 : 16;
+    int pawns = white ? 0 : 24;
+    char number = (code.size() == 3) ? code[2] : '0';
+    
+    int index;
+    switch (code[1]) {
+        case 'P': index = pawns + (number - '1'); break;
+        case 'R': index = backRank + (number == '1' ? 0 : 7); break;
+        case 'N': index = backRank + (number == '1' ? 1 : 6); break;
+        case 'B': index = backRank + (number == '1' ? 2 : 5); break;
+        case 'Q': index = backRank + 3; break;
+        case 'K': index = backRank + 4; break;
+        default: return -1;
+    }
+    if (index < 0 || index >= PIECE_COUNT) return -1;
+    return code == PIECE_CODES[index] ? index : -1;
+}
+
+// What became of a move typed in by a player
+enum MoveOutcome { MOVE_REJECTED, MOVE_PLAYED, MOVE_ENDS_GAME };
+
+enum GameResult { IN_PROGRESS, CHECKMATE, STALEMATE, FIFTY_MOVE_DRAW, REPETITION_DRAW, TIME_FORFEIT };
+
+// Game class
+class Game {
+private:
+    Position pos;
+    uint8_t pieceSquare[PIECE_COUNT];   // piece index -> square, NO_SQUARE once captured
+    int8_t squareIndex[64];             // square -> piece index, -1 when empty
+    KeyHistory hashHistory;             // hash of every position reached, for repetition detection
+    Move lastMove = 0;
+    
+public:
+    Game() {
+        initializeBoard();
+    }
+    
+    void initializeBoard() {
+        static const PieceType BACK_RANK[8] = {ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK};
         
-        if (wouldBeInCheck(from, to, currentTurn)) {
-            cout << "\n*** ERROR: Move would leave king in check! ***\n";
-            return false;
+        // Initialize empty board
+        for (int sq = 0; sq < 64; sq++) {
+            pos.squares[sq] = EMPTY;
+            squareIndex[sq] = -1;
         }
         
-        // Execute move
-        Piece* captured = board[to.first][to.second];
-        if (captured != nullptr) {
-            cout << "\n*** SUCCESS: You captured " << captured->name << " (" << captured->getType() << ")! ***\n";
-            movesSinceCapture = 0;
-        } else {
-            movesSinceCapture++;
+        // Place pieces (Black pieces at top, White pieces at bottom)
+        for (int i = 0; i < 8; i++) {
+            pos.squares[toSquare(0, i)] = makePiece(BLACK, BACK_RANK[i]);
+            pos.squares[toSquare(1, i)] = makePiece(BLACK, PAWN);
+            pos.squares[toSquare(6, i)] = makePiece(WHITE, PAWN);
+            pos.squares[toSquare(7, i)] = makePiece(WHITE, BACK_RANK[i]);
         }
         
-        board[to.first][to.second] = piece;
-        board[from.first][from.second] = nullptr;
-        piece->hasMoved = true;
+        pos.sideToMove = WHITE;
+        pos.castlingRights = WHITE_KINGSIDE | WHITE_QUEENSIDE | BLACK_KINGSIDE | BLACK_QUEENSIDE;
+        pos.epSquare = NO_SQUARE;
+        pos.halfmoveClock = 0;
+        pos.fullmoveNumber = 1;
+        pos.hash = computeHash(pos);
         
-        // Update castling flags
-        if (piece->getType() == "King") {
-            if (currentTurn == WHITE) whiteKingMoved = true;
-            else blackKingMoved = true;
-        } else if (piece->getType() == "Rook") {
-            if (currentTurn == WHITE) {
-                if (from.second == 0) whiteRookLeftMoved = true;
-                else if (from.second == 7) whiteRookRightMoved = true;
-            } else {
-                if (from.second == 0) blackRookLeftMoved = true;
-                else if (from.second == 7) blackRookRightMoved = true;
+        hashHistory.clear();
+        hashHistory.push_back(pos.hash);
+        
+        // Every piece starts on the square its index encodes
+        for (int i = 0; i < PIECE_COUNT; i++) {
+            pieceSquare[i] = startSquareOf(i);
+            squareIndex[startSquareOf(i)] = i;
+        }
+    }
+    
+    // Starts from an arbitrary FEN position. Pieces take a free code of their own type first;
+    // extra pieces left over from promotions take a free pawn code of their color.
+    bool setPosition(const string& fen) {
+        Position parsed;
+        return parseFen(fen, parsed) && setPosition(parsed);
+    }
+    
+    bool setPosition(const Position& parsed) {
+        uint8_t squares[PIECE_COUNT];
+        int8_t indices[64];
+        fill(squares, squares + PIECE_COUNT, NO_SQUARE);
+        fill(indices, indices + 64, -1);
+        
+        for (int pass = 0; pass < 2; pass++) {
+            for (int sq = 0; sq < 64; sq++) {
+                Piece piece = parsed.squares[sq];
+                if (piece == EMPTY || indices[sq] != -1) continue;
+                
+                int begin = (colorOf(piece) == WHITE) ? 0 : 16;
+                PieceType wanted = (pass == 0) ? typeOf(piece) : PAWN;
+                for (int i = begin; i < begin + 16; i++) {
+                    if (squares[i] == NO_SQUARE && codeTypeOf(i) == wanted) {
+                        squares[i] = sq;
+                        indices[sq] = i;
+                        break;
+                    }
+                }
+                if (pass == 1 && indices[sq] == -1) return false;
             }
         }
         
-        updatePiecePositions();
+        pos = parsed;
+        copy(squares, squares + PIECE_COUNT, pieceSquare);
+        copy(indices, indices + 64, squareIndex);
+        hashHistory.clear();
+        hashHistory.push_back(pos.hash);
+        return true;
+    }
+    
+    const Position& position() const { return pos; }
+    const KeyHistory& history() const { return hashHistory; }
+    
+    // Keeps the piece list in step with a piece moving from 'from' to 'to', removing any piece it lands on
+    void movePieceIndex(int from, int to) {
+        if (squareIndex[to] != -1) {
+            pieceSquare[squareIndex[to]] = NO_SQUARE;
+        }
+        squareIndex[to] = squareIndex[from];
+        squareIndex[from] = -1;
+        pieceSquare[squareIndex[to]] = to;
+    }
+    
+    void removePieceIndex(int sq) {
+        pieceSquare[squareIndex[sq]] = NO_SQUARE;
+        squareIndex[sq] = -1;
+    }
+    
+    // Plays a move known to be legal, keeping the piece list and position history in step
+    void playMove(Move move) {
+        int from = moveFrom(move), to = moveTo(move);
+        Piece piece = pos.squares[from];
         
-        // Check for check/checkmate
-        Color oppositeColor = (currentTurn == WHITE) ? BLACK : WHITE;
-        if (isInCheck(oppositeColor)) {
-            cout << "\n*** CHECK! ***\n";
-            if (isCheckmate(oppositeColor)) {
-                cout << "\n*** CHECKMATE! " << (currentTurn == WHITE ? "White" : "Black") << " wins! ***\n";
-                return true;
+        if (typeOf(piece) == KING && abs(to - from) == 2) {
+            // The rook moves alongside the king
+            if (to > from) {
+                movePieceIndex(from + 3, from + 1);
+            } else {
+                movePieceIndex(from - 4, from - 1);
             }
-        } else if (isStalemate(oppositeColor)) {
-            cout << "\n*** STALEMATE! It's a draw! ***\n";
-            return true;
+        } else if (typeOf(piece) == PAWN && to == pos.epSquare) {
+            removePieceIndex(toSquare(rowOf(from), colOf(to)));
         }
         
-        // Check for 50-move rule
-        if (movesSinceCapture >= 100) {
-            cout << "\n*** DRAW by 50-move rule! ***\n";
-            return true;
+        movePieceIndex(from, to);
+        applyMove(pos, move);
+        hashHistory.push_back(pos.hash);
+        lastMove = move;
+    }
+    
+    // Adjudicates the position after a move: the side to move may be mated or stalemated,
+    // or the game drawn by the 50-move rule or threefold repetition
+    GameResult result() {
+        if (!hasLegalMove(pos)) {
+            return isInCheck(pos, pos.sideToMove) ? CHECKMATE : STALEMATE;
         }
-        
-        currentTurn = oppositeColor;
-        return false;
+        if (pos.halfmoveClock >= 100) return FIFTY_MOVE_DRAW;
+        if (isThreefoldRepetition()) return REPETITION_DRAW;
+        return IN_PROGRESS;
     }
     
-    void play() {
-        printBoard();
-        
-        while (true) {
-            cout << "\n*** " << (currentTurn == WHITE ? "White's" : "Black's") << " turn ***\n";
-            showAlivePieces(currentTurn);
-            
-            cout << "\n*** Available directions (short forms): ***\n";
-            cout << "For Pawns: U, SLU, SRU\n";
-            cout << "For Knights: UL, UR, LU, LD, RU, RD, DL, DR\n";
-            cout << "For others: U, D, L, R, SLU, SLD, SRU, SRD\n";
-            cout << "For King: CL, CR (in addition to above)\n\n";
-            
-            string pieceCode, direction;
-            int steps;
-            
-            cout << "Enter piece code (or 'quit' to exit): ";
-            cin >> pieceCode;
-            
-            if (pieceCode == "quit") {
-                cout << "\n*** Game ended by user. ***\n";
-                break;
+    // The current position has already occurred twice since the last capture or pawn move
+    bool isThreefoldRepetition() {
+        int last = (int)hashHistory.size() - 1;
+        int oldest = max(0, last - (int)pos.halfmoveClock);
+        int seen = 1;
+        for (int i = last - 2; i >= oldest; i -= 2) {
+            if (hashHistory[i] == pos.hash && ++seen == 3) {
+                return true;
             }
-            
-            // Clear input buffer to prevent infinite loop
-            cin.clear();
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
-            
+        }
+        return false;
+    }
+    
+    void printBoard() {
+        cout << "\n";
+        cout << "  +-----+-----+-----+-----+-----+-----+-----+-----+\n";
+        for (int i = 0; i < 8; i++) {
+            cout << (8 - i) << " |";
+            for (int j = 0; j < 8; j++) {
+                int index = squareIndex[toSquare(i, j)];
+                if (index != -1) {
+                    cout << setw(4) << PIECE_CODES[index] << " |";
+                } else {
+                    cout << "     |";
+                }
+            }
+            cout << "\n";
+            cout << "  +-----+-----+-----+-----+-----+-----+-----+-----+\n";
+        }
+        cout << "     a     b     c     d     e     f     g     h\n\n";
+    }
+    
+    void showAlivePieces(Color color) {
+        cout << "\n*** " << (color == WHITE ? "White's" : "Black's") << " alive pieces: ***\n";
+        bool first = true;
+        int begin = (color == WHITE) ? 0 : 16;
+        for (int i = begin; i < begin + 16; i++) {
+            if (pieceSquare[i] != NO_SQUARE) {
+                if (!first) cout << ", ";
+                cout << PIECE_CODES[i];
+                // Promoted pawns keep their code; show what they became
+                PieceType type = typeOf(pos.squares[pieceSquare[i]]);
+                if (PIECE_CODES[i][1] == 'P' && type != PAWN) {
+                    cout << "=" << "PNBRQK"[type - 1];
+                }
+                first = false;
+            }
+        }
+        cout << "\n";
+    }
+    
+    MoveOutcome makeMove(const string& pieceCode, int direction, int steps, PieceType promotion = QUEEN) {
+        int index = pieceIndexOf(pieceCode);
+        if (index == -1 || pieceSquare[index] == NO_SQUARE) {
+            cout << "\n*** ERROR: Piece '" << pieceCode << "' not found! ***\n";
+            return MOVE_REJECTED;
+        }
+        
+        int from = pieceSquare[index];
+        Piece piece = pos.squares[from];
+        Color currentTurn = pos.sideToMove;
+        
+        if (colorOf(piece) != currentTurn) {
+            cout << "\n*** ERROR: It's not your turn! ***\n";
+            return MOVE_REJECTED;
+        }
+        
+        Move move;
+        
+        // Handle castling
+        if (typeOf(piece) == KING && (direction == CASTLE_LEFT || direction == CASTLE_RIGHT)) {
+            bool kingside = (direction == CASTLE_RIGHT);
+            if (!canCastle(pos, currentTurn, kingside)) {
+                cout << "\n*** ERROR: Cannot castle! ***\n";
+                return MOVE_REJECTED;
+            }
+            
+            move = encodeMove(from, from + (kingside ? 2 : -2));
+        } else {
+            if (direction == NO_DIRECTION || direction == CASTLE_LEFT || direction == CASTLE_RIGHT) {
+                cout << "\n*** ERROR: Invalid move! ***\n";
+                return MOVE_REJECTED;
+            }
+            
+            const DirectionInfo& info = DIRECTIONS[direction];
+            int scale = info.needsSteps ? steps : 1;
+            int toRow = rowOf(from) + info.rowDelta * scale;
+            int toCol = colOf(from) + info.colDelta * scale;
+            
+            if (!onBoard(toRow, toCol)) {
+                cout << "\n*** ERROR: Invalid move - out of bounds! ***\n";
+                return MOVE_REJECTED;
+            }
+            int to = toSquare(toRow, toCol);
+            
+            if (!canReach(pos, from, to)) {
+                cout << "\n*** ERROR: Invalid move! ***\n";
+                return MOVE_REJECTED;
+            }
+            
+            bool promotes = typeOf(piece) == PAWN && (toRow == 0 || toRow == 7);
+            if (promotes && (promotion == NO_TYPE || promotion == PAWN || promotion == KING)) {
+                cout << "\n*** ERROR: Pawns promote to Q, R, B or N! ***\n";
+                return MOVE_REJECTED;
+            }
+            move = encodeMove(from, to, promotes ? promotion : NO_TYPE);
+            
+            if (wouldBeInCheck(pos, move)) {
+                cout << "\n*** ERROR: Move would leave king in check! ***\n";
+                return MOVE_REJECTED;
+            }
+            
+            int capturedSq = (typeOf(piece) == PAWN && to == pos.epSquare) ? toSquare(rowOf(from), toCol) : to;
+            Piece captured = pos.squares[capturedSq];
+            if (captured != EMPTY) {
+                cout << "\n*** SUCCESS: You captured " << PIECE_CODES[squareIndex[capturedSq]] << " (" << TYPE_NAMES[typeOf(captured)] << ")! ***\n";
+            }
+            if (promotes) {
+                cout << "\n*** " << pieceCode << " promoted to " << TYPE_NAMES[promotion] << "! ***\n";
+            }
+        }
+        
+        // Execute move
+        playMove(move);
+        return reportResult(currentTurn) ? MOVE_ENDS_GAME : MOVE_PLAYED;
+    }
+    
+    // Announces check and the end of the game after 'mover' has moved; true if the game is over
+    bool reportResult(Color mover) {
+        if (isInCheck(pos, pos.sideToMove)) {
+            cout << "\n*** CHECK! ***\n";
+        }
+        
+        switch (result()) {
+            case CHECKMATE:
+                cout << "\n*** CHECKMATE! " << (mover == WHITE ? "White" : "Black") << " wins! ***\n";
+                return true;
+            case STALEMATE:
+                cout << "\n*** STALEMATE! It's a draw! ***\n";
+                return true;
+            case FIFTY_MOVE_DRAW:
+                cout << "\n*** DRAW by 50-move rule! ***\n";
+                return true;
+            case REPETITION_DRAW:
+                cout << "\n*** DRAW by threefold repetition! ***\n";
+                return true;
+            default:
+                return false;
+        }
+    }
+    
+    // Lets 'engine' play 'engineColor' within 'limits'. While waiting for the human's move
+    // it ponders on the reply it expects.
+    bool playEngineMove(Search& engine, Ponderer& ponderer, const SearchLimits& limits) {
+        SearchResult found;
+        bool ponderHit = ponderer.finish(lastMove, found);
+        if (!ponderHit) {
+            found = engine.think(pos, limits, hashHistory);
+        }
+        
+        Move move = found.bestMove;
+        cout << "\n*** Engine plays " << PIECE_CODES[squareIndex[moveFrom(move)]] << " (" << toSan(pos, move) << ")"
+             << (ponderHit ? ", ponder hit" : "") << " ***\n";
+        playMove(move);
+        printBoard();
+        
+        if (reportResult(opposite(pos.sideToMove))) {
+            return true;
+        }
+        
+        Move reply = engine.expectedMove(pos);
+        if (reply != 0) {
+            ponderer.start(pos, reply, limits, hashHistory);
+        }
+        return false;
+    }
+    
+    // Human play at the console; with an engine, it takes the 'engineColor' side
+    void play(Search* engine = nullptr, Color engineColor = BLACK, const SearchLimits& engineLimits = SearchLimits()) {
+        Ponderer ponderer(engine);
+        printBoard();
+        
+        while (true) {
+            if (engine != nullptr && pos.sideToMove == engineColor) {
+                if (playEngineMove(*engine, ponderer, engineLimits)) {
+                    cout << "\n*** Game Over! ***\n";
+                    break;
+                }
+                continue;
+            }
+            
+            cout << "\n*** " << (pos.sideToMove == WHITE ? "White's" : "Black's") << " turn ***\n";
+            showAlivePieces(pos.sideToMove);
+            
+            cout << "\n*** Available directions (short forms): ***\n";
+            cout << "For Pawns: U, SLU, SRU\n";
+            cout << "For Knights: UL, UR, LU, LD, RU, RD, DL, DR\n";
+            cout << "For others: U, D, L, R, SLU, SLD, SRU, SRD\n";
+            cout << "For King: CL, CR (in addition to above)\n";
+            cout << "Pawns promote to a queen; add =R, =B or =N to the direction to underpromote (e.g. U=N)\n\n";
+            
+            string pieceCode, directionToken;
+            int steps = 1;
+            
+            cout << "Enter piece code (or 'quit' to exit): ";
+            if (!(cin >> pieceCode) || pieceCode == "quit") {
+                cout << "\n*** Game ended by user. ***\n";
+                break;
+            }
+            
+            // Clear input buffer to prevent infinite loop
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            
             cout << "Enter direction (short form): ";
-            cin >> direction;
+            cin >> directionToken;
             
             // Clear input buffer
             cin.clear();
             cin.ignore(numeric_limits<streamsize>::max(), '\n');
             
-            // Expand short direction to full form
-            direction = expandDirection(direction);
-            
             // For knight moves and castling, steps are not needed
-            if (direction == "upleft" || direction == "upright" || 
-                direction == "leftup" || direction == "leftdown" ||
-                direction == "rightup" || direction == "rightdown" ||
-                direction == "downleft" || direction == "downright" ||
-                direction == "castle-left" || direction == "castle-right") {
-                steps = 1; // Default for knight moves and castling
-            } else {
+            string_view token = directionToken;
+            PieceType promotion = splitPromotion(token);
+            int direction = findDirection(token);
+            if (directionNeedsSteps(direction)) {
                 cout << "Enter number of steps: ";
                 cin >> steps;
                 
                 // Handle invalid input for steps
-                while (cin.fail()) {
+                while (cin.fail() && !cin.eof()) {
                     cin.clear();
                     cin.ignore(numeric_limits<streamsize>::max(), '\n');
                     cout << "\n*** ERROR: Please enter a valid number! ***\n";
@@ -864,24 +1832,1008 @@ public:
                 }
             }
             
-            bool gameOver = makeMove(pieceCode, direction, steps);
+            MoveOutcome outcome = makeMove(pieceCode, direction, steps, promotion);
             printBoard();
             
-            if (gameOver) {
+            if (outcome == MOVE_ENDS_GAME) {
+                cout << "\n*** Game Over! ***\n";
+                break;
+            }
+        }
+    }
+    
+    // Replays moves given in the same order the prompts ask for them (piece code,
+    // direction, steps when needed) with no prompts and no per-move board output.
+    // Returns false if the script is malformed or a move in it is rejected, naming
+    // the line the move starts on; the board is left as it was before that move.
+    bool runScript(istream& in) {
+        string pieceCode, directionToken, stepsToken, line;
+        istringstream words;
+        int lineNumber = 0;
+        
+        // Next whitespace-separated token, moving on to later lines as needed
+        auto nextToken = [&](string& token) {
+            while (!(words >> token)) {
+                if (!getline(in, line)) return false;
+                lineNumber++;
+                words.clear();
+                words.str(line);
+            }
+            return true;
+        };
+        
+        while (nextToken(pieceCode) && pieceCode != "quit") {
+            int moveLine = lineNumber;
+            if (!nextToken(directionToken)) {
+                cout << "\n*** ERROR: Script ended in the middle of a move on line " << moveLine << "! ***\n";
+                return false;
+            }
+            
+            string_view token = directionToken;
+            PieceType promotion = splitPromotion(token);
+            int direction = findDirection(token);
+            int steps = 1;
+            if (directionNeedsSteps(direction)) {
+                char* end = nullptr;
+                if (nextToken(stepsToken)) steps = (int)strtol(stepsToken.c_str(), &end, 10);
+                if (end == nullptr || *end != '\0' || end == stepsToken.c_str()) {
+                    cout << "\n*** ERROR: Expected a number of steps after '" << pieceCode << " " << directionToken
+                         << "' on line " << moveLine << "! ***\n";
+                    return false;
+                }
+            }
+            
+            MoveOutcome outcome = makeMove(pieceCode, direction, steps, promotion);
+            if (outcome == MOVE_REJECTED) {
+                cout << "\n*** ERROR: Script move on line " << moveLine << " was rejected! ***\n";
+                printBoard();
+                return false;
+            }
+            if (outcome == MOVE_ENDS_GAME) {
                 cout << "\n*** Game Over! ***\n";
                 break;
             }
         }
+        
+        printBoard();
+        return true;
+    }
+};
+
+// Elo difference implied by a score fraction
+double eloFromScore(double score) {
+    score = min(max(score, 1e-6), 1.0 - 1e-6);
+    return -400.0 * log10(1.0 / score - 1.0);
+}
+
+// Match results from the first engine's point of view
+struct MatchScore {
+    int wins = 0, losses = 0, draws = 0;
+    
+    int games() const { return wins + losses + draws; }
+    double score() const { return games() ? (wins + 0.5 * draws) / games() : 0.5; }
+    
+    // Per-game variance of the score
+    double variance() const {
+        if (games() == 0) return 0;
+        double s = score();
+        return (wins * (1 - s) * (1 - s) + losses * s * s + draws * (0.5 - s) * (0.5 - s)) / games();
+    }
+    
+    double elo() const { return eloFromScore(score()); }
+    
+    // Half-width of the 95% confidence interval around elo()
+    double eloMargin() const {
+        if (games() == 0) return 0;
+        double deviation = 1.96 * sqrt(variance() / games());
+        return (eloFromScore(score() + deviation) - eloFromScore(score() - deviation)) / 2;
+    }
+    
+    // Log-likelihood ratio of H1 (elo1) against H0 (elo0) in the normal approximation used by SPRT
+    double llr(double elo0, double elo1) const {
+        double var = variance();
+        if (var <= 0) return 0;
+        double s0 = 1 / (1 + pow(10, -elo0 / 400));
+        double s1 = 1 / (1 + pow(10, -elo1 / 400));
+        return games() * (s1 - s0) * (2 * score() - s0 - s1) / (2 * var);
+    }
+};
+
+struct EngineSettings {
+    string name;
+    SearchLimits limits;
+};
+
+struct TournamentOptions {
+    int games = 100;
+    int threads = 1;
+    string openingsFile;                  // one FEN or EPD position per line; the start position if empty
+    string pgnFile = "tournament.pgn";
+    EngineSettings engines[2];
+    double elo0 = 0, elo1 = 5;            // SPRT hypotheses, alpha = beta = 0.05
+};
+
+// Transposition table size of the self-play engines
+const int SELF_PLAY_TT_BITS = 16;
+
+// One finished self-play game: where it started, the moves played and how it ended
+struct SelfPlayGame {
+    Position start;
+    const Move* moves;
+    int moveCount;
+    GameResult result;
+    Color winner;
+};
+
+// Arena space for one self-play game: the game, both engines and the move record
+size_t selfPlayArenaBytes() {
+    return sizeof(Game) + alignof(Game) + 2 * Search::arenaBytes(SELF_PLAY_TT_BITS) +
+           MAX_GAME_PLIES * sizeof(Move) + alignof(Move);
+}
+
+// Plays a game from 'start' with engine 0 taking White when 'firstIsWhite'. The game, both
+// engines and the move record are carved out of 'arena', which is reset first instead of
+// freeing anything from the last game, so the game itself never calls the global allocator.
+// The moves stay valid until the arena is next reset. Engines whose limits carry a clock
+// play on it, measured in virtual time when nodesPerMs is set, and lose if it runs out.
+bool playSelfPlayGame(Arena& arena, const Position& start, bool firstIsWhite, const SearchLimits limits[2],
+                      SelfPlayGame& played) {
+    arena.reset();
+    Game& game = *arena.create<Game>();
+    if (!game.setPosition(start)) return false;
+    Search* searches[2] = {arena.create<Search>(arena, SELF_PLAY_TT_BITS), arena.create<Search>(arena, SELF_PLAY_TT_BITS)};
+    Move* moves = arena.allocateArray<Move>(MAX_GAME_PLIES);
+    
+    double clocks[2] = {double(limits[0].timeLeftMs), double(limits[1].timeLeftMs)};
+    
+    played.start = start;
+    played.moves = moves;
+    played.moveCount = 0;
+    while ((played.result = game.result()) == IN_PROGRESS) {
+        const Position& pos = game.position();
+        int engine = ((pos.sideToMove == WHITE) == firstIsWhite) ? 0 : 1;
+        SearchLimits moveLimits = limits[engine];
+        bool onClock = moveLimits.timeLeftMs > 0;
+        if (onClock) moveLimits.timeLeftMs = max(1, (int)clocks[engine]);
+        
+        auto moveStart = chrono::steady_clock::now();
+        SearchResult found = searches[engine]->think(pos, moveLimits, game.history());
+        if (onClock) {
+            clocks[engine] -= moveLimits.nodesPerMs != 0
+                ? double(found.nodes) / moveLimits.nodesPerMs
+                : chrono::duration<double, milli>(chrono::steady_clock::now() - moveStart).count();
+            if (clocks[engine] < 0) {
+                played.result = TIME_FORFEIT;
+                played.winner = opposite(pos.sideToMove);
+                return true;
+            }
+            clocks[engine] += moveLimits.incrementMs;
+        }
+        moves[played.moveCount++] = found.bestMove;
+        game.playMove(found.bestMove);
+    }
+    played.winner = opposite(game.position().sideToMove);
+    return true;
+}
+
+// Self-play match between two engine settings. Games run on worker threads, each reusing
+// one arena for its games; openings are played twice with colors swapped.
+class Tournament {
+private:
+    TournamentOptions options;
+    vector<Position> openings;
+    ofstream pgn;
+    mutex lock;                           // guards everything below, the PGN file and cout
+    atomic<int> nextGame{0};
+    atomic<bool> decided{false};
+    MatchScore score;
+    double sprtLower, sprtUpper;
+    
+    bool loadOpenings() {
+        Position parsed;
+        if (options.openingsFile.empty()) {
+            parseFen(START_FEN, parsed);
+            openings.push_back(parsed);
+            return true;
+        }
+        ifstream in(options.openingsFile);
+        if (!in) {
+            cerr << "Cannot open openings file '" << options.openingsFile << "'\n";
+            return false;
+        }
+        string line;
+        while (getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            if (!parseFen(line, parsed)) {
+                cerr << "Skipping invalid opening: " << line << "\n";
+                continue;
+            }
+            openings.push_back(parsed);
+        }
+        if (openings.empty()) {
+            cerr << "No usable openings in '" << options.openingsFile << "'\n";
+            return false;
+        }
+        return true;
+    }
+    
+    // Each worker thread keeps one arena for all the games it plays
+    void worker() {
+        Arena arena(selfPlayArenaBytes());
+        int index;
+        while (!decided && (index = nextGame++) < options.games) {
+            playGame(arena, index);
+        }
+    }
+    
+    void playGame(Arena& arena, int index) {
+        bool firstIsWhite = (index % 2 == 0);
+        const SearchLimits limits[2] = {options.engines[0].limits, options.engines[1].limits};
+        SelfPlayGame played;
+        if (!playSelfPlayGame(arena, openings[(index / 2) % openings.size()], firstIsWhite, limits, played)) {
+            lock_guard<mutex> guard(lock);
+            cerr << "Game " << index + 1 << ": opening has pieces that cannot be named, skipped\n";
+            return;
+        }
+        
+        string resultTag = "1/2-1/2";
+        int firstScore = 0;
+        if (played.result == CHECKMATE || played.result == TIME_FORFEIT) {
+            resultTag = (played.winner == WHITE) ? "1-0" : "0-1";
+            firstScore = ((played.winner == WHITE) == firstIsWhite) ? 1 : -1;
+        }
+        
+        static const char* const REASONS[] = {"", "checkmate", "stalemate", "50-move rule", "threefold repetition", "time forfeit"};
+        recordGame(index, firstIsWhite, played, resultTag, REASONS[played.result], firstScore);
+    }
+    
+    void recordGame(int index, bool firstIsWhite, const SelfPlayGame& played,
+                    const string& resultTag, const string& reason, int firstScore) {
+        const Position& start = played.start;
+        const string& white = options.engines[firstIsWhite ? 0 : 1].name;
+        const string& black = options.engines[firstIsWhite ? 1 : 0].name;
+        
+        ostringstream out;
+        out << "[Event \"Self-play\"]\n[Site \"?\"]\n[Round \"" << index + 1 << "\"]\n"
+            << "[White \"" << white << "\"]\n[Black \"" << black << "\"]\n"
+            << "[Result \"" << resultTag << "\"]\n";
+        string startFen = toFen(start);
+        if (startFen != START_FEN) {
+            out << "[SetUp \"1\"]\n[FEN \"" << startFen << "\"]\n";
+        }
+        out << "\n";
+        
+        // Movetext, wrapped to keep lines short. SAN is worked out here, after the game, by replaying it.
+        string line;
+        int moveNumber = start.fullmoveNumber;
+        bool whiteToMove = (start.sideToMove == WHITE);
+        Position replay = start;
+        for (int i = 0; i < played.moveCount; i++) {
+            string token;
+            if (whiteToMove) token = to_string(moveNumber) + ". ";
+            else if (i == 0) token = to_string(moveNumber) + "... ";
+            token += toSan(replay, played.moves[i]);
+            applyMove(replay, played.moves[i]);
+            if (!whiteToMove) moveNumber++;
+            whiteToMove = !whiteToMove;
+            
+            if (line.size() + token.size() + 1 > 79) {
+                out << line << "\n";
+                line.clear();
+            }
+            line += (line.empty() ? "" : " ") + token;
+        }
+        out << line << (line.empty() ? "" : " ") << "{" << reason << "} " << resultTag << "\n\n";
+        
+        lock_guard<mutex> guard(lock);
+        pgn << out.str() << flush;
+        
+        if (firstScore > 0) score.wins++;
+        else if (firstScore < 0) score.losses++;
+        else score.draws++;
+        
+        double llr = score.llr(options.elo0, options.elo1);
+        cout << "Game " << index + 1 << "/" << options.games << " (" << white << " vs " << black << "): "
+             << resultTag << " by " << reason
+             << " | W-L-D " << score.wins << "-" << score.losses << "-" << score.draws
+             << " | Elo " << showpos << fixed << setprecision(1) << score.elo() << noshowpos
+             << " +/- " << score.eloMargin()
+             << " | LLR " << setprecision(2) << llr << "\n";
+        
+        if (!decided && (llr <= sprtLower || llr >= sprtUpper)) {
+            decided = true;
+            cout << "SPRT finished: " << (llr >= sprtUpper ? "H1" : "H0") << " accepted\n";
+        }
+    }
+    
+public:
+    explicit Tournament(const TournamentOptions& tournamentOptions)
+        : options(tournamentOptions),
+          sprtLower(log(0.05 / 0.95)),
+          sprtUpper(log(0.95 / 0.05)) {}
+    
+    bool run() {
+        if (!loadOpenings()) return false;
+        pgn.open(options.pgnFile, ios::app);
+        if (!pgn) {
+            cerr << "Cannot write PGN file '" << options.pgnFile << "'\n";
+            return false;
+        }
+        
+        cout << options.engines[0].name << " vs " << options.engines[1].name << ": "
+             << options.games << " games on " << options.threads << " threads, "
+             << openings.size() << " opening(s), SPRT [" << options.elo0 << ", " << options.elo1 << "]\n";
+        
+        vector<thread> workers;
+        for (int i = 0; i < options.threads; i++) {
+            workers.emplace_back(&Tournament::worker, this);
+        }
+        for (thread& worker : workers) {
+            worker.join();
+        }
+        
+        cout << "\n*** Final: " << options.engines[0].name << " scored W-L-D "
+             << score.wins << "-" << score.losses << "-" << score.draws
+             << ", Elo " << showpos << fixed << setprecision(1) << score.elo() << noshowpos
+             << " +/- " << score.eloMargin()
+             << ", LLR " << setprecision(2) << score.llr(options.elo0, options.elo1)
+             << " (" << sprtLower << ", " << sprtUpper << ") ***\n";
+        return true;
+    }
+};
+
+// Reads the --tournament options; the second engine inherits the first one's limits unless given its own
+bool parseTournamentOptions(int argc, char* argv[], TournamentOptions& options) {
+    options.threads = max(1, (int)thread::hardware_concurrency());
+    SearchLimits limits[2];
+    bool ownLimits[2] = {false, false};
+    uint64_t nodesPerMs = 0;
+    
+    for (int i = 2; i < argc; i++) {
+        string flag = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (flag == "--sprt" && i + 2 < argc) {
+            options.elo0 = atof(argv[++i]);
+            options.elo1 = atof(argv[++i]);
+        } else if (!hasValue) {
+            cerr << "Missing value for " << flag << "\n";
+            return false;
+        } else if (flag == "--games") {
+            options.games = atoi(argv[++i]);
+        } else if (flag == "--threads") {
+            options.threads = max(1, atoi(argv[++i]));
+        } else if (flag == "--openings") {
+            options.openingsFile = argv[++i];
+        } else if (flag == "--pgn") {
+            options.pgnFile = argv[++i];
+        } else if (flag == "--nodes" || flag == "--nodes2") {
+            int engine = (flag == "--nodes2") ? 1 : 0;
+            limits[engine].nodes = strtoull(argv[++i], nullptr, 10);
+            ownLimits[engine] = true;
+        } else if (flag == "--movetime" || flag == "--movetime2") {
+            int engine = (flag == "--movetime2") ? 1 : 0;
+            limits[engine].moveTimeMs = atoi(argv[++i]);
+            ownLimits[engine] = true;
+        } else if (flag == "--tc" || flag == "--tc2") {
+            // Clock as seconds plus increment, e.g. 10+0.1
+            int engine = (flag == "--tc2") ? 1 : 0;
+            char* rest;
+            limits[engine].timeLeftMs = (int)(strtod(argv[++i], &rest) * 1000);
+            limits[engine].incrementMs = (*rest == '+') ? (int)(strtod(rest + 1, nullptr) * 1000) : 0;
+            ownLimits[engine] = true;
+        } else if (flag == "--npms") {
+            nodesPerMs = strtoull(argv[++i], nullptr, 10);
+        } else {
+            cerr << "Unknown tournament option " << flag << "\n";
+            return false;
+        }
+    }
+    
+    if (!ownLimits[0]) limits[0].nodes = 20000;
+    if (!ownLimits[1]) limits[1] = limits[0];
+    
+    for (int engine = 0; engine < 2; engine++) {
+        SearchLimits& l = limits[engine];
+        l.nodesPerMs = nodesPerMs;
+        options.engines[engine].limits = l;
+        
+        vector<string> parts;
+        if (l.nodes) parts.push_back(to_string(l.nodes) + " nodes");
+        if (l.moveTimeMs) parts.push_back(to_string(l.moveTimeMs) + " ms");
+        if (l.timeLeftMs) parts.push_back(to_string(l.timeLeftMs) + "+" + to_string(l.incrementMs) + " ms");
+        string name = string(engine == 0 ? "A" : "B") + " (";
+        for (size_t i = 0; i < parts.size(); i++) {
+            name += (i ? ", " : "") + parts[i];
+        }
+        options.engines[engine].name = name + ")";
+    }
+    return options.games > 0;
+}
+
+// The allocation check needs the global operator new replaced, which is only done in
+// builds made for it: g++ -DCHESS_ALLOC_CHECK ... The normal build keeps the standard one.
+#ifdef CHESS_ALLOC_CHECK
+
+// Global allocations made by the current thread, counted by the replacement operator new below
+thread_local uint64_t allocationCount = 0;
+
+// The replacements stay out of line: inlined, GCC would pair operator new's malloc() with
+// operator delete, or free() with operator new, and warn about a mismatch that isn't there
+[[gnu::noinline]] void* operator new(size_t size) {
+    allocationCount++;
+    if (void* memory = malloc(size == 0 ? 1 : size)) return memory;
+    throw bad_alloc();
+}
+
+// Replaced too, so every block the delete operators below free came from malloc
+[[gnu::noinline]] void* operator new(size_t size, const nothrow_t&) noexcept {
+    allocationCount++;
+    return malloc(size == 0 ? 1 : size);
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, const nothrow_t&) noexcept { free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+// Plays self-play games through the tournament's per-thread path and counts global
+// allocations made while they run. Any allocation there is reported as a failure.
+int runAllocationCheck(int games, const SearchLimits& limits) {
+    Arena arena(selfPlayArenaBytes());
+    const SearchLimits both[2] = {limits, limits};
+    Position start;
+    parseFen(START_FEN, start);
+    
+    uint64_t total = 0;
+    for (int i = 0; i < games; i++) {
+        SelfPlayGame played;
+        uint64_t before = allocationCount;
+        playSelfPlayGame(arena, start, i % 2 == 0, both, played);
+        uint64_t made = allocationCount - before;
+        total += made;
+        cout << "Game " << i + 1 << ": " << played.moveCount << " moves, " << made << " allocations\n";
+    }
+    cout << "Arena: " << arena.bytesUsed() << " bytes per game\n";
+    if (total != 0) {
+        cout << "\n*** ERROR: " << total << " global allocations during self-play ***\n";
+        return 1;
+    }
+    cout << "No global allocations during self-play\n";
+    return 0;
+}
+
+#endif
+
+// Times searches on 'threads' threads at once, more threads than cores standing in for a
+// loaded machine, and reports how far any search ran past its hard time limit. Each position
+// is searched with a fixed move time and on a clock. Node-based virtual time must give the
+// same result on every run.
+int runTimeCheck(int moveTimeMs, int threads) {
+    static const char* const FENS[] = {
+        START_FEN,
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    };
+    
+    mutex lock;
+    double worst = -100;
+    double fixedUse = 0;                // summed share of the move time used by fixed-time searches
+    int searches = 0;
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            Arena arena(Search::arenaBytes(16));
+            Search& search = *arena.create<Search>(arena);
+            for (const char* fen : FENS) {
+                for (int onClock = 0; onClock < 2; onClock++) {
+                    Position pos;
+                    parseFen(fen, pos);
+                    SearchLimits limits;
+                    if (onClock) {
+                        limits.timeLeftMs = 30 * moveTimeMs;
+                        limits.incrementMs = moveTimeMs / 10;
+                    } else {
+                        limits.moveTimeMs = moveTimeMs;
+                    }
+                    TimeManager budget;
+                    budget.start(limits);
+                    
+                    search.clear();
+                    auto start = chrono::steady_clock::now();
+                    search.think(pos, limits, NO_HISTORY);
+                    double used = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                    
+                    lock_guard<mutex> guard(lock);
+                    worst = max(worst, 100 * (used - budget.maximum()) / budget.maximum());
+                    if (!onClock) fixedUse += used / moveTimeMs;
+                    searches++;
+                }
+            }
+        });
+    }
+    for (thread& worker : workers) {
+        worker.join();
+    }
+    
+    // Virtual time: the same clock and node rate must reproduce the same search exactly
+    bool reproducible = true;
+    for (const char* fen : FENS) {
+        Position pos;
+        parseFen(fen, pos);
+        SearchLimits limits;
+        limits.timeLeftMs = 30 * moveTimeMs;
+        limits.nodesPerMs = 100;
+        SearchResult runs[2];
+        for (SearchResult& run : runs) {
+            Arena arena(Search::arenaBytes(16));
+            run = arena.create<Search>(arena)->think(pos, limits, NO_HISTORY);
+        }
+        reproducible &= runs[0].bestMove == runs[1].bestMove && runs[0].nodes == runs[1].nodes;
+    }
+    
+    cout << searches << " searches on " << threads << " threads, worst overshoot " << fixed << setprecision(2)
+         << max(0.0, worst) << "% of the hard limit, fixed move times used "
+         << 100 * fixedUse / (searches / 2) << "% on average\n"
+         << "Virtual time " << (reproducible ? "reproducible" : "NOT reproducible") << "\n";
+    if (worst >= 1.0 || !reproducible) {
+        cout << "\n*** ERROR: time management check failed ***\n";
+        return 1;
+    }
+    return 0;
+}
+
+// Read-only view of a file: memory-mapped on POSIX systems, read into memory elsewhere
+class MappedFile {
+private:
+    const char* view = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+    
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+    
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        ifstream in(path, ios::binary);
+        if (!in) return false;
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        view = buffer.data();
+        length = buffer.size();
+        return true;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        bool ok = fstat(fd, &info) == 0;
+        if (ok && info.st_size > 0) {
+            void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ok = mapping != MAP_FAILED;
+            if (ok) {
+                view = (const char*)mapping;
+                length = info.st_size;
+            }
+        }
+        ::close(fd);
+        return ok;
+#endif
+    }
+    
+    void close() {
+#ifndef _WIN32
+        if (view != nullptr) munmap((void*)view, length);
+#endif
+        view = nullptr;
+        length = 0;
+    }
+    
+    const char* data() const { return view; }
+    size_t size() const { return length; }
+};
+
+// One analysed position, also the fixed-size record of the on-disk log
+struct AnalysisRecord {
+    uint64_t key;              // Zobrist hash of the analysed position
+    uint64_t nodes;
+    uint32_t timeMs;           // time budget of the search, or the time it took if that was longer
+    int16_t score;
+    Move bestMove;
+    uint8_t depth;
+    uint8_t reserved[3];
+    uint32_t checksum;         // guards against torn or corrupted records
+};
+
+static_assert(sizeof(AnalysisRecord) == 32, "AnalysisRecord is written to disk as is");
+
+const char CACHE_MAGIC[8] = {'C', 'H', 'S', 'C', 'A', 'C', 'H', '1'};
+
+uint32_t recordChecksum(const AnalysisRecord& record) {
+    // FNV-1a over everything but the checksum itself
+    const unsigned char* bytes = (const unsigned char*)&record;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < offsetof(AnalysisRecord, checksum); i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// A stored result answers a request when it went at least as far on every limit the request sets
+bool satisfies(const AnalysisRecord& record, const SearchLimits& request) {
+    if (request.depth < MAX_PLY && record.depth < request.depth) return false;
+    if (request.nodes != 0 && record.nodes < request.nodes) return false;
+    if (request.moveTimeMs != 0 && record.timeMs < (uint32_t)request.moveTimeMs) return false;
+    return true;
+}
+
+// Deeper searches win; at equal depth the one that looked at more nodes, then the one known to hold for longer
+inline bool isBetterRecord(const AnalysisRecord& a, const AnalysisRecord& b) {
+    if (a.depth != b.depth) return a.depth > b.depth;
+    return a.nodes != b.nodes ? a.nodes > b.nodes : a.timeMs > b.timeMs;
+}
+
+// Analysis results keyed by position hash. An LRU map in memory sits in front of an
+// append-only log on disk that is memory-mapped for reads. Only the best record per
+// position matters; older ones stay in the log until it is compacted offline.
+class AnalysisCache {
+private:
+    struct CachedEntry {
+        AnalysisRecord record;
+        list<uint64_t>::iterator lruPosition;
+    };
+    
+    size_t capacity;
+    unordered_map<uint64_t, CachedEntry> memory;
+    list<uint64_t> lru;                            // most recently used first
+    unordered_map<uint64_t, size_t> diskIndex;     // key -> offset of its best record in the log
+    MappedFile mapped;
+    ofstream log;
+    string path;
+    size_t logSize = 0;
+    
+    void remember(const AnalysisRecord& record) {
+        if (capacity == 0) return;
+        
+        auto it = memory.find(record.key);
+        if (it != memory.end()) {
+            it->second.record = record;
+            lru.splice(lru.begin(), lru, it->second.lruPosition);
+            return;
+        }
+        if (memory.size() >= capacity) {
+            memory.erase(lru.back());
+            lru.pop_back();
+        }
+        lru.push_front(record.key);
+        memory[record.key] = {record, lru.begin()};
+    }
+    
+    bool readDisk(uint64_t key, AnalysisRecord& record) {
+        auto it = diskIndex.find(key);
+        if (it == diskIndex.end()) return false;
+        
+        // Records appended since the log was mapped need a fresh mapping
+        if (it->second + sizeof(AnalysisRecord) > mapped.size() && !mapped.open(path)) return false;
+        memcpy(&record, mapped.data() + it->second, sizeof(AnalysisRecord));
+        return true;
+    }
+    
+public:
+    explicit AnalysisCache(size_t entries = 1 << 16) : capacity(entries) {}
+    
+    // Opens or creates the log at 'logPath' and indexes the best record for each position
+    bool open(const string& logPath) {
+        path = logPath;
+        if (!ifstream(path, ios::binary)) {
+            ofstream create(path, ios::binary);
+            create.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+            if (!create) return false;
+        }
+        
+        if (!mapped.open(path) || mapped.size() < sizeof(CACHE_MAGIC) ||
+            memcmp(mapped.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) {
+            cerr << "'" << path << "' is not an analysis cache\n";
+            return false;
+        }
+        
+        size_t offset = sizeof(CACHE_MAGIC);
+        for (; offset + sizeof(AnalysisRecord) <= mapped.size(); offset += sizeof(AnalysisRecord)) {
+            AnalysisRecord record;
+            memcpy(&record, mapped.data() + offset, sizeof(AnalysisRecord));
+            if (record.checksum != recordChecksum(record)) continue;
+            
+            AnalysisRecord known;
+            if (!readDisk(record.key, known) || isBetterRecord(record, known)) {
+                diskIndex[record.key] = offset;
+            }
+        }
+        logSize = offset;
+        
+        // A record torn by a crash mid-append is cut off so later appends stay aligned
+        if (logSize != mapped.size()) {
+            mapped.close();
+            error_code ignored;
+            filesystem::resize_file(path, logSize, ignored);
+        }
+        
+        log.open(path, ios::binary | ios::app);
+        return (bool)log;
+    }
+    
+    // Finds the stored result for 'key', if there is one good enough for 'request'
+    bool lookup(uint64_t key, const SearchLimits& request, AnalysisRecord& record) {
+        auto it = memory.find(key);
+        if (it != memory.end()) {
+            lru.splice(lru.begin(), lru, it->second.lruPosition);
+            record = it->second.record;
+        } else if (readDisk(key, record)) {
+            remember(record);
+        } else {
+            return false;
+        }
+        return satisfies(record, request);
+    }
+    
+    // Keeps 'record' if it improves on what is known for its position, appending it to the log
+    void store(AnalysisRecord record) {
+        AnalysisRecord known;
+        auto it = memory.find(record.key);
+        bool haveKnown = (it != memory.end()) ? (known = it->second.record, true) : readDisk(record.key, known);
+        if (haveKnown && !isBetterRecord(record, known)) {
+            // A longer search that got no further still shows the known result holds for that long
+            if (record.timeMs <= known.timeMs) return;
+            known.timeMs = record.timeMs;
+            record = known;
+        }
+        
+        record.checksum = recordChecksum(record);
+        remember(record);
+        if (log.is_open()) {
+            log.write((const char*)&record, sizeof(record));
+            log.flush();
+            diskIndex[record.key] = logSize;
+            logSize += sizeof(record);
+        }
+    }
+    
+    // Offline compaction: rewrites the log with only the best record per position
+    static bool compact(const string& logPath) {
+        AnalysisCache cache(0);
+        if (!cache.open(logPath)) return false;
+        cache.log.close();
+        
+        string tempPath = logPath + ".tmp";
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        out.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        for (const auto& entry : cache.diskIndex) {
+            AnalysisRecord record;
+            cache.readDisk(entry.first, record);
+            out.write((const char*)&record, sizeof(record));
+        }
+        out.close();
+        if (!out) return false;
+        
+        size_t before = (cache.logSize - sizeof(CACHE_MAGIC)) / sizeof(AnalysisRecord);
+        cache.mapped.close();
+        error_code error;
+        filesystem::rename(tempPath, logPath, error);
+        if (error) return false;
+        
+        cout << "Compacted " << before << " records to " << cache.diskIndex.size() << "\n";
+        return true;
     }
 };
 
-int main() {
+// Prints the best 'lines' moves of a position (0 means every legal move); these
+// bypass the cache, which only holds the single best line per position
+void printMultiPV(Search& search, const Position& pos, const SearchLimits& limits, int lines) {
+    auto start = chrono::steady_clock::now();
+    int depth = 0;
+    vector<RootMove> found = (lines == 0) ? search.scoreAllMoves(pos, limits, NO_HISTORY, &depth)
+                                          : search.analyse(pos, limits, NO_HISTORY, lines, &depth);
+    auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+    
+    if (found.empty()) {
+        cout << "no legal moves\n" << flush;
+        return;
+    }
+    for (size_t i = 0; i < found.size(); i++) {
+        cout << "multipv " << i + 1 << " " << toSan(pos, found[i].move) << " score " << found[i].score << "\n";
+    }
+    cout << "depth " << depth << " nodes " << search.nodeCount() << " (searched, " << micros << " us)\n" << flush;
+}
+
+// Answers analysis requests, one FEN per line on stdin, from the cache when it can.
+// Without a cache file the cache lives in memory only.
+int runAnalysis(const SearchLimits& limits, const string& cachePath, int lines) {
+    AnalysisCache cache;
+    if (!cachePath.empty() && !cache.open(cachePath)) return 1;
+    Arena arena(Search::arenaBytes(16));
+    Search& search = *arena.create<Search>(arena);
+    
+    string line;
+    while (getline(cin, line)) {
+        if (line.empty()) continue;
+        
+        Position pos;
+        if (!parseFen(line, pos)) {
+            cout << "error: invalid FEN\n";
+            continue;
+        }
+        if (lines != 1) {
+            printMultiPV(search, pos, limits, lines);
+            continue;
+        }
+        
+        auto start = chrono::steady_clock::now();
+        AnalysisRecord record;
+        bool cached = cache.lookup(pos.hash, limits, record);
+        if (cached) {
+            // Guard against a hash collision handing back a move from another position
+            MoveList legal;
+            generateLegalMoves(pos, legal);
+            cached = record.bestMove == 0 ? legal.count == 0
+                                          : find(legal.moves, legal.moves + legal.count, record.bestMove) != legal.moves + legal.count;
+        }
+        if (!cached) {
+            SearchResult result = search.think(pos, limits, NO_HISTORY);
+            record = {};
+            record.key = pos.hash;
+            record.nodes = result.nodes;
+            // The time manager stops just short of --movetime, so a search it ended counts as
+            // having had the whole budget; one that ended on depth, nodes or a mate only as long as it took
+            auto tookMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+            record.timeMs = (uint32_t)(result.stoppedByTime ? max<int64_t>(tookMs, limits.moveTimeMs) : tookMs);
+            record.score = (int16_t)result.score;
+            record.bestMove = result.bestMove;
+            record.depth = (uint8_t)result.depth;
+            cache.store(record);
+        }
+        auto micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+        
+        if (record.bestMove == 0) {
+            cout << "no legal moves";
+        } else {
+            cout << "bestmove " << toSan(pos, record.bestMove) << " score " << record.score
+                 << " depth " << (int)record.depth << " nodes " << record.nodes;
+        }
+        cout << (cached ? " (cached, " : " (searched, ") << micros << " us)\n" << flush;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Self-play match: --tournament [--games N] [--threads N] [--openings FILE] [--pgn FILE]
+    //                  [--nodes N] [--movetime MS] [--tc SECONDS+INC] [--nodes2 N] [--movetime2 MS]
+    //                  [--tc2 SECONDS+INC] [--npms N] [--sprt ELO0 ELO1]
+    if (argc >= 2 && string(argv[1]) == "--tournament") {
+        TournamentOptions options;
+        if (!parseTournamentOptions(argc, argv, options)) {
+            return 1;
+        }
+        Tournament tournament(options);
+        return tournament.run() ? 0 : 1;
+    }
+    
+    // Allocation check of the self-play path: --alloc-check [games] [nodes]
+    if (argc >= 2 && string(argv[1]) == "--alloc-check") {
+#ifdef CHESS_ALLOC_CHECK
+        SearchLimits limits;
+        limits.nodes = (argc >= 4) ? strtoull(argv[3], nullptr, 10) : 5000;
+        return runAllocationCheck(argc >= 3 ? max(1, atoi(argv[2])) : 2, limits);
+#else
+        cerr << "\n*** ERROR: --alloc-check needs a build made with -DCHESS_ALLOC_CHECK ***\n";
+        return 1;
+#endif
+    }
+    
+    // Time management check: --time-check [movetime MS] [threads], by default twice the core count
+    if (argc >= 2 && string(argv[1]) == "--time-check") {
+        int moveTimeMs = (argc >= 3) ? max(10, atoi(argv[2])) : 500;
+        int threads = (argc >= 4) ? max(1, atoi(argv[3])) : 2 * max(1, (int)thread::hardware_concurrency());
+        return runTimeCheck(moveTimeMs, threads);
+    }
+    
+    // Cached analysis of FEN lines from stdin:
+    //   --analyse [--depth N] [--nodes N] [--movetime MS] [--cache FILE] [--multipv N|all]
+    if (argc >= 2 && string(argv[1]) == "--analyse") {
+        SearchLimits limits;
+        string cachePath;
+        int lines = 1;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            string flag = argv[i];
+            if (flag == "--depth") limits.depth = atoi(argv[i + 1]);
+            else if (flag == "--nodes") limits.nodes = strtoull(argv[i + 1], nullptr, 10);
+            else if (flag == "--movetime") limits.moveTimeMs = atoi(argv[i + 1]);
+            else if (flag == "--cache") cachePath = argv[i + 1];
+            else if (flag == "--multipv") lines = (string(argv[i + 1]) == "all") ? 0 : max(1, atoi(argv[i + 1]));
+            else {
+                cerr << "Unknown analysis option " << flag << "\n";
+                return 1;
+            }
+        }
+        if (limits.depth == MAX_PLY && limits.nodes == 0 && limits.moveTimeMs == 0) {
+            limits.depth = 6;
+        }
+        return runAnalysis(limits, cachePath, lines);
+    }
+    
+    // Offline compaction of an analysis cache: --compact-cache FILE
+    if (argc == 3 && string(argv[1]) == "--compact-cache") {
+        return AnalysisCache::compact(argv[2]) ? 0 : 1;
+    }
+    
+    // Move generator self-check against the standard perft positions: --perft-check
+    if (argc == 2 && string(argv[1]) == "--perft-check") {
+        return runPerftCheck() ? 0 : 1;
+    }
+    
+    // Move generator check: --perft <depth> ["FEN"]
+    if (argc >= 3 && string(argv[1]) == "--perft") {
+        int depth = atoi(argv[2]);
+        if (depth < 0) {
+            cerr << "Usage: --perft <depth >= 0> [\"FEN\"]\n";
+            return 1;
+        }
+        Position pos;
+        if (!parseFen(argc >= 4 ? argv[3] : START_FEN, pos)) {
+            cerr << "Invalid FEN\n";
+            return 1;
+        }
+        auto start = chrono::steady_clock::now();
+        uint64_t nodes = perft(pos, depth);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << "Nodes: " << nodes << "\nTime: " << fixed << setprecision(3) << seconds << "s\n";
+        return 0;
+    }
+    
+    // Non-interactive replay: --script <file>, or '-' to read from stdin
+    if (argc == 3 && string(argv[1]) == "--script") {
+        ios::sync_with_stdio(false);
+        Game game;
+        if (string(argv[2]) == "-") {
+            return game.runScript(cin) ? 0 : 1;
+        }
+        ifstream script(argv[2]);
+        if (!script) {
+            cerr << "Cannot open script '" << argv[2] << "'\n";
+            return 1;
+        }
+        return game.runScript(script) ? 0 : 1;
+    }
+    
+    // Play against the engine: --vs-engine [white|black] [--movetime MS], naming the human's color
+    unique_ptr<Arena> engineArena;
+    Search* engine = nullptr;
+    Color engineColor = BLACK;
+    SearchLimits engineLimits;
+    engineLimits.moveTimeMs = 1000;
+    if (argc >= 2 && string(argv[1]) == "--vs-engine") {
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "white" || arg == "black") {
+                engineColor = (arg == "white") ? BLACK : WHITE;
+            } else if (arg == "--movetime" && i + 1 < argc) {
+                engineLimits.moveTimeMs = max(1, atoi(argv[++i]));
+            } else {
+                cerr << "Unknown option " << arg << "\n";
+                return 1;
+            }
+        }
+        engineArena = make_unique<Arena>(Search::arenaBytes(20));
+        engine = engineArena->create<Search>(*engineArena, 20);
+    }
+    
     cout << "\n*** Welcome to Chess Game! ***\n";
     cout << "Piece codes: WP1-8/BP1-8 (Pawns), WN1-2/BN1-2 (Knights), WB1-2/BB1-2 (Bishops), WR1-2/BR1-2 (Rooks), WQ/BQ (Queen), WKG/BKG (King)\n";
     cout << "Type 'quit' as piece code to exit\n\n";
     
     Game game;
-    game.play();
+    game.play(engine, engineColor, engineLimits);
     
     return 0;
 }